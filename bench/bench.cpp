@@ -0,0 +1,382 @@
+#include "parsing.hpp"
+#include "containers.hpp"
+#include "generator.hpp"
+#include "results.hpp"
+#include "threadpool.hpp"
+#include "uring.hpp"
+#include "utils.hpp"
+#include "walker.hpp"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <functional>
+#include <random>
+#include <unistd.h>
+
+
+// Benchmarks for the parts of xdupes that tend to regress: walking, the task queue, hashing and grouping. Every
+// result is printed to stdout as one JSON object per line, so runs from two builds can be diffed or fed to a script.
+// Everything else goes to stderr.
+
+namespace {
+
+  // How much work one run of a benchmark did
+  struct Work {
+    std::size_t items = 0;
+    std::size_t bytes = 0;
+  };
+
+  struct Settings {
+    std::size_t repeat = 3;
+    std::string filter;
+  };
+
+  // Run `fn` `repeat` times and print the timings. Rates are taken from the median run.
+  auto measure(const Settings& settings, const std::string& name, const std::string& param, const std::function<Work()>& fn) -> void {
+    std::string full_name = param.empty() ? name : name + "/" + param;
+    if (!settings.filter.empty() and full_name.find(settings.filter) == std::string::npos) {
+      return;
+    }
+    std::cerr << "running " << full_name << std::endl;
+
+    std::vector<std::size_t> times;
+    Work work;
+    for (std::size_t run = 0; run < std::max<std::size_t>(settings.repeat, 1); ++run) {
+      std::size_t t0 = now();
+      work = fn();
+      times.push_back(now() - t0);
+    }
+    std::sort(times.begin(), times.end());
+    std::size_t total = 0;
+    for (std::size_t t : times) {
+      total += t;
+    }
+    std::size_t median = times.at(times.size() / 2);
+    double seconds = std::max<double>(median, 1) / 1e9;
+
+    std::cout << "{\"type\": \"result\", \"bench\": \"" << name << "\", \"param\": \"" << param << "\""
+              << ", \"runs\": " << times.size() << ", \"items\": " << work.items << ", \"bytes\": " << work.bytes
+              << ", \"min_ns\": " << times.front() << ", \"median_ns\": " << median
+              << ", \"mean_ns\": " << total / times.size() << ", \"max_ns\": " << times.back()
+              << ", \"items_per_s\": " << static_cast<std::size_t>(work.items / seconds)
+              << ", \"bytes_per_s\": " << static_cast<std::size_t>(work.bytes / seconds) << "}" << std::endl;
+  }
+
+  // Push `count` indices through a BoundedQueue with `producers` threads on one end and as many consumers on the other.
+  auto bench_queue(std::size_t producers, std::size_t count) -> Work {
+    BoundedQueue<std::size_t> queue(65536);
+    std::atomic<std::size_t> consumed = 0;
+    std::vector<std::thread> threads;
+    for (std::size_t ix = 0; ix < producers; ++ix) {
+      threads.emplace_back([&, ix] {
+        for (std::size_t item = ix; item < count; item += producers) {
+          while (!queue.try_push(item)) {
+            std::this_thread::yield();
+          }
+        }
+      });
+      threads.emplace_back([&] {
+        std::size_t item;
+        while (consumed.load(std::memory_order_relaxed) < count) {
+          if (queue.try_pop(item)) {
+            consumed.fetch_add(1, std::memory_order_relaxed);
+          }
+          else {
+            std::this_thread::yield();
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    return {count, 0};
+  }
+
+  // Hash `data`, which is already in memory, `chunk` bytes per update, the same way the workers do.
+  auto bench_hash_memory(const std::vector<char>& data, std::size_t chunk) -> Work {
+    XXH3_state_t* state = XXH3_createState();
+    XXH3_128bits_reset(state);
+    for (std::size_t offset = 0; offset < data.size(); offset += chunk) {
+      XXH3_128bits_update(state, data.data() + offset, std::min(chunk, data.size() - offset));
+    }
+    volatile XXH64_hash_t sink = XXH3_128bits_digest(state).low64;
+    (void) sink;
+    XXH3_freeState(state);
+    return {1, data.size()};
+  }
+
+  // Read and hash whole files with read() calls of `chunk` bytes. These come out of the page cache after the first
+  // run, so this measures the syscall and copy overhead per buffer size rather than the disk.
+  auto bench_hash_files(const std::vector<std::string>& paths, std::size_t chunk) -> Work {
+    XXH3_state_t* state = XXH3_createState();
+    std::vector<char> buffer(chunk);
+    Work work;
+    for (const auto& path : paths) {
+      int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+        continue;
+      }
+      XXH3_128bits_reset(state);
+      ssize_t got;
+      while ((got = read(fd, buffer.data(), buffer.size())) > 0) {
+        XXH3_128bits_update(state, buffer.data(), got);
+        work.bytes += got;
+      }
+      close(fd);
+      volatile XXH64_hash_t sink = XXH3_128bits_digest(state).low64;
+      (void) sink;
+      work.items++;
+    }
+    XXH3_freeState(state);
+    return work;
+  }
+
+  // File `count` digests into per-thread shards, `dupes` to a key, and merge them.
+  auto bench_grouping(std::size_t shards, std::size_t count, std::size_t dupes) -> Work {
+    ResultTable table;
+    table.resize(shards);
+    for (std::size_t ix = 0; ix < count; ++ix) {
+      std::uint64_t key = ix / std::max<std::size_t>(dupes, 1);
+      XXH128_hash_t hash = XXH3_128bits(&key, sizeof(key));
+      table.add(ix % shards, key % 1024, hash, ix);
+    }
+    table.merge();
+    return {count, 0};
+  }
+
+  auto bench_walk(const std::string& root, std::size_t threads, WalkEngine engine) -> Work {
+    Walker walker(threads, true, engine);
+    walker.start({root});
+    walker.join();
+    return {walker.walked(), 0};
+  }
+
+  // The whole thing minus the output: walk, then head and tail probes and full hashes over the same-size buckets.
+  auto bench_pipeline(const std::string& root, std::size_t threads, IoEngine engine) -> Work {
+    Walker walker(threads, true);
+    walker.start({root});
+    walker.join();
+
+    Work work = {walker.walked(), 0};
+
+    std::vector<std::vector<Task>> groups;
+    auto& files = walker.files;
+    for (std::size_t begin = 0, end = 0; begin < files.size(); begin = end) {
+      end = begin + 1;
+      while (end < files.size() and files.at(end).size == files.at(begin).size) {
+        end++;
+      }
+      if (end - begin >= 2) {
+        groups.emplace_back(std::make_move_iterator(files.begin() + begin), std::make_move_iterator(files.begin() + end));
+      }
+    }
+
+    ThreadPool tp(threads);
+    tp.set_paths(&walker.paths);
+    tp.set_io(engine, 8);
+    tp.start();
+
+    const std::vector<std::pair<Stage, std::size_t>> stages = {{Stage::head, 4096}, {Stage::tail, 4096}, {Stage::full, 0}};
+    for (const auto& [stage, block] : stages) {
+      tp.set_stage(stage, block);
+      for (std::size_t gix = 0; gix < groups.size(); ++gix) {
+        for (auto& task : groups.at(gix)) {
+          task.group = gix;
+          work.bytes += stage == Stage::full ? task.size : std::min(block, task.size);
+          tp.enqueue(std::move(task));
+        }
+      }
+      tp.join();
+
+      std::vector<std::vector<Task>> survivors;
+      for (std::size_t key = 0; key < tp.results.size(); ++key) {
+        auto members = tp.results.members(key);
+        if (members.size() < 2) {
+          continue;
+        }
+        std::vector<Task> files;
+        for (std::size_t ix : members) {
+          files.push_back(std::move(tp.task(ix)));
+        }
+        survivors.emplace_back(std::move(files));
+      }
+      groups = std::move(survivors);
+      tp.reset();
+    }
+    tp.stop();
+    return work;
+  }
+
+}
+
+
+auto create_parser() -> parsing::ArgumentParser;
+
+auto main(int argc, char** argv) -> int {
+  namespace fs = std::filesystem;
+
+  auto parser = create_parser();
+  auto options = parser.parse_args(argc - 1, argv + 1);
+
+  for (const auto& name : {"threads", "repeat", "files", "depth", "fanout", "min-size", "max-size", "seed"}) {
+    if (!is_number(options[name].as_string())) {
+      std::cerr << name << " must be a positive integer" << std::endl;
+      return 1;
+    }
+  }
+
+  Settings settings;
+  settings.repeat = options["repeat"].as_size_t();
+  settings.filter = options["filter"].as_string();
+
+  std::size_t threads = options["threads"].as_size_t();
+  if (threads == 0) {
+    threads = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+  }
+
+  TreeSpec spec;
+  spec.files = options["files"].as_size_t();
+  spec.depth = options["depth"].as_size_t();
+  spec.fanout = options["fanout"].as_size_t();
+  spec.size_dist = options["size-dist"].as_string();
+  spec.min_size = options["min-size"].as_size_t();
+  spec.max_size = options["max-size"].as_size_t();
+  spec.duplicates = std::stod(options["duplicates"].as_string());
+  spec.hardlinks = std::stod(options["hardlinks"].as_string());
+  spec.shared_prefix = std::stod(options["shared-prefix"].as_string());
+  spec.seed = options["seed"].as_size_t();
+
+  std::string root = options["root"].as_string();
+  if (root.empty()) {
+    root = (fs::temp_directory_path() / ("xdupes-bench-" + std::to_string(getpid()))).native();
+  }
+
+  std::cerr << "generating " << spec.files << " files under " << root << std::endl;
+  TreeStats tree;
+  try {
+    tree = generate_tree(root, spec);
+  }
+  catch (const std::exception& error) {
+    std::cerr << error.what() << std::endl;
+    return 1;
+  }
+
+  // Enough to describe the run, so results from different builds can be matched up
+  std::cout << "{\"type\": \"meta\", \"compiler\": \"" << __VERSION__ << "\", \"threads\": " << threads
+            << ", \"repeat\": " << settings.repeat << ", \"seed\": " << spec.seed << ", \"files\": " << tree.files
+            << ", \"directories\": " << tree.directories << ", \"bytes\": " << tree.bytes
+            << ", \"duplicates\": " << tree.duplicates << ", \"hardlinks\": " << tree.hardlinks
+            << ", \"shared_prefix\": " << tree.shared_prefix << ", \"size_dist\": \"" << spec.size_dist << "\"}"
+            << std::endl;
+
+  // Thread counts to sweep: 1, 2, 4, ... up to `threads`
+  std::vector<std::size_t> sweep;
+  for (std::size_t count = 1; count < threads; count *= 2) {
+    sweep.push_back(count);
+  }
+  sweep.push_back(threads);
+
+  // Micro benchmarks
+  for (std::size_t count : sweep) {
+    measure(settings, "queue", std::to_string(count), [&] { return bench_queue(count, 1 << 21); });
+  }
+
+  std::vector<char> data(64 << 20);
+  std::mt19937_64 rng(spec.seed);
+  std::generate(data.begin(), data.end(), [&] { return static_cast<char>(rng()); });
+
+  std::vector<std::string> paths;
+  for (const auto& entry : fs::recursive_directory_iterator(root)) {
+    if (entry.is_regular_file()) {
+      paths.push_back(entry.path().native());
+    }
+  }
+  std::sort(paths.begin(), paths.end());
+
+  for (std::size_t chunk : {4096, 16384, 65536, 262144, 1048576, 4194304}) {
+    measure(settings, "hash.memory", std::to_string(chunk), [&] { return bench_hash_memory(data, chunk); });
+    measure(settings, "hash.files", std::to_string(chunk), [&] { return bench_hash_files(paths, chunk); });
+  }
+
+  for (std::size_t dupes : {1, 2, 8}) {
+    measure(settings, "grouping", std::to_string(dupes), [&] { return bench_grouping(threads + 1, 1 << 20, dupes); });
+  }
+
+  // Macro benchmarks
+  for (std::size_t count : sweep) {
+    measure(settings, "walk", std::to_string(count), [&] { return bench_walk(root, count, WalkEngine::getdents); });
+    measure(settings, "walk.filesystem", std::to_string(count), [&] { return bench_walk(root, count, WalkEngine::filesystem); });
+  }
+
+  for (std::size_t count : sweep) {
+    measure(settings, "pipeline.sync", std::to_string(count), [&] { return bench_pipeline(root, count, IoEngine::sync); });
+    if (Ring::supported()) {
+      measure(settings, "pipeline.uring", std::to_string(count), [&] { return bench_pipeline(root, count, IoEngine::uring); });
+    }
+  }
+
+  if (!options["keep"].as_bool()) {
+    std::error_code ec;
+    fs::remove_all(root, ec);
+  }
+
+  return 0;
+}
+
+
+auto create_parser() -> parsing::ArgumentParser {
+  parsing::ArgumentParser parser = parsing::ArgumentParser::create_parser("xdupes_bench");
+  parser.add_help(false);
+
+  parsing::ActionGroup& tree_group = parser.add_argument_group("Tree");
+  tree_group.add_argument({"--root"})
+      .default_value("")
+      .help("Where to generate the tree (must not exist yet). Defaults to a fresh directory under the system temp dir.");
+  tree_group.add_argument({"--files"})
+      .default_value("5000")
+      .help("How many files to generate, hardlinks included.");
+  tree_group.add_argument({"--depth"})
+      .default_value("3")
+      .help("How many levels of directories to nest below the root.");
+  tree_group.add_argument({"--fanout"})
+      .default_value("4")
+      .help("How many subdirectories every directory gets.");
+  tree_group.add_argument({"--size-dist"})
+      .default_value("log")
+      .help("How file sizes are drawn: 'fixed' (always --min-size), 'uniform' or 'log' (log-uniform).");
+  tree_group.add_argument({"--min-size"})
+      .default_value("1024")
+      .help("Smallest file size, in bytes.");
+  tree_group.add_argument({"--max-size"})
+      .default_value("262144")
+      .help("Largest file size, in bytes.");
+  tree_group.add_argument({"--duplicates"})
+      .default_value("0.3")
+      .help("Fraction of files that are copies of an earlier file.");
+  tree_group.add_argument({"--hardlinks"})
+      .default_value("0.05")
+      .help("Fraction of files that are hardlinks to an earlier file.");
+  tree_group.add_argument({"--shared-prefix"})
+      .default_value("0.1")
+      .help("Fraction of files that match an earlier file everywhere but one byte in the middle.");
+  tree_group.add_argument({"--seed"})
+      .default_value("1")
+      .help("Seed for everything random. The same seed and options always give the same tree.");
+  tree_group.add_argument({"--keep"})
+      .action(parsing::actions::store_true)
+      .help("Leave the generated tree behind when done.");
+
+  parsing::ActionGroup& run_group = parser.add_argument_group("Run");
+  run_group.add_argument({"--threads", "-t"})
+      .default_value("0")
+      .help("Most threads to sweep up to (1, 2, 4, ...). 0 for one per core.");
+  run_group.add_argument({"--repeat"})
+      .default_value("3")
+      .help("How many times to run each benchmark.");
+  run_group.add_argument({"--filter"})
+      .default_value("")
+      .help("Only run benchmarks whose name contains this.");
+
+  return parser;
+}
@@ -0,0 +1,120 @@
+#include "generator.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <unistd.h>
+#include <vector>
+
+
+namespace {
+
+  // A file whose bytes can be regenerated from (seed, size), optionally with one byte flipped halfway through
+  struct Content {
+    std::uint64_t seed;
+    std::size_t size;
+    std::string path;
+  };
+
+  auto write_content(const std::string& path, const Content& content, bool flip_middle) -> void {
+    std::mt19937_64 rng(content.seed);
+    std::vector<char> buffer(content.size);
+    for (std::size_t ix = 0; ix < buffer.size(); ix += sizeof(std::uint64_t)) {
+      std::uint64_t word = rng();
+      std::copy_n(reinterpret_cast<const char*>(&word), std::min(sizeof(word), buffer.size() - ix), &buffer[ix]);
+    }
+    if (flip_middle and !buffer.empty()) {
+      buffer[buffer.size() / 2] ^= 0x5a;
+    }
+    std::ofstream ofs(path, std::ios_base::binary);
+    ofs.write(buffer.data(), buffer.size());
+    if (!ofs) {
+      throw std::runtime_error("cannot write " + path);
+    }
+  }
+
+  auto draw_size(std::mt19937_64& rng, const TreeSpec& spec) -> std::size_t {
+    std::size_t low = std::min(spec.min_size, spec.max_size);
+    std::size_t high = std::max(spec.min_size, spec.max_size);
+    if (spec.size_dist == "fixed") {
+      return spec.min_size;
+    }
+    if (spec.size_dist == "uniform") {
+      return std::uniform_int_distribution<std::size_t>(low, high)(rng);
+    }
+    if (spec.size_dist == "log") {
+      double lo = std::log(static_cast<double>(std::max<std::size_t>(low, 1)));
+      double hi = std::log(static_cast<double>(std::max<std::size_t>(high, 1)));
+      return static_cast<std::size_t>(std::exp(std::uniform_real_distribution<double>(lo, hi)(rng)));
+    }
+    throw std::invalid_argument("unknown size distribution: " + spec.size_dist);
+  }
+
+}
+
+
+auto generate_tree(const std::string& root, const TreeSpec& spec) -> TreeStats {
+  namespace fs = std::filesystem;
+
+  if (fs::exists(root)) {
+    throw std::invalid_argument("refusing to generate into an existing path: " + root);
+  }
+
+  TreeStats stats;
+  std::mt19937_64 rng(spec.seed);
+
+  // Breadth first, so directory names (and with them every path) only depend on the spec
+  std::vector<std::string> dirs = {root};
+  fs::create_directories(root);
+  for (std::size_t first = 0, level = 0; level < spec.depth; ++level) {
+    std::size_t last = dirs.size();
+    for (std::size_t ix = first; ix < last; ++ix) {
+      for (std::size_t child = 0; child < spec.fanout; ++child) {
+        dirs.push_back(dirs.at(ix) + "/d" + std::to_string(child));
+        fs::create_directory(dirs.back());
+      }
+    }
+    first = last;
+  }
+  stats.directories = dirs.size();
+
+  std::uniform_real_distribution<double> roll(0.0, 1.0);
+  std::vector<Content> originals;
+
+  for (std::size_t ix = 0; ix < spec.files; ++ix) {
+    std::string path = dirs.at(rng() % dirs.size()) + "/f" + std::to_string(ix);
+    double r = roll(rng);
+
+    if (originals.empty() or r >= spec.hardlinks + spec.duplicates + spec.shared_prefix) {
+      Content content = {rng(), draw_size(rng, spec), path};
+      write_content(path, content, false);
+      stats.bytes += content.size;
+      originals.push_back(std::move(content));
+    }
+    else {
+      const Content& earlier = originals.at(rng() % originals.size());
+      if (r < spec.hardlinks) {
+        if (link(earlier.path.c_str(), path.c_str()) != 0) {
+          throw std::runtime_error("cannot link " + path);
+        }
+        stats.hardlinks++;
+      }
+      else if (r < spec.hardlinks + spec.duplicates or earlier.size == 0) {
+        write_content(path, earlier, false);
+        stats.bytes += earlier.size;
+        stats.duplicates++;
+      }
+      else {
+        write_content(path, earlier, true);
+        stats.bytes += earlier.size;
+        stats.shared_prefix++;
+      }
+    }
+    stats.files++;
+  }
+
+  return stats;
+}
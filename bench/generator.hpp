@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+
+// What a synthetic tree should look like. The same spec (seed included) always produces byte-for-byte the same tree.
+struct TreeSpec {
+  std::size_t files = 5000;
+  // Directories nest `depth` levels deep below the root, with `fanout` subdirectories each
+  std::size_t depth = 3;
+  std::size_t fanout = 4;
+  // How sizes are drawn from [min_size, max_size]: "fixed" (always min_size), "uniform", or "log" (log-uniform, so
+  // small files are common and big ones rare, like most real trees)
+  std::string size_dist = "log";
+  std::size_t min_size = 1024;
+  std::size_t max_size = 262144;
+  // Fractions of files that are exact copies of an earlier file, hardlinks to one, or the same size as one with
+  // matching heads and tails and a single differing byte in the middle (so the probes can't tell them apart)
+  double duplicates = 0.3;
+  double hardlinks = 0.05;
+  double shared_prefix = 0.1;
+  std::uint64_t seed = 1;
+};
+
+// What actually got written
+struct TreeStats {
+  std::size_t files = 0;
+  std::size_t directories = 0;
+  std::size_t bytes = 0;
+  std::size_t duplicates = 0;
+  std::size_t hardlinks = 0;
+  std::size_t shared_prefix = 0;
+};
+
+// Build the tree under `root`, which must not exist yet.
+auto generate_tree(const std::string& root, const TreeSpec& spec) -> TreeStats;
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "threadpool.hpp"
+
+
+// On-disk layout of one cached file. Fixed size, so the whole cache is just a header followed by a sorted array of
+// these, which can be binary searched straight out of the mapping.
+struct CacheEntry {
+  std::uint64_t dev;
+  std::uint64_t ino;
+  std::uint64_t size;
+  std::uint64_t mtime_ns;
+  std::uint64_t ctime_ns;
+  // Block sizes the probes were taken with (0 if there is no probe digest), and the HashKind they were taken with
+  std::uint64_t head_size;
+  std::uint64_t tail_size;
+  std::uint64_t probe_hash;
+  // Non-zero if `full` holds a digest: 1 for one taken in a single stream, 2 for one taken in segments
+  std::uint64_t has_full;
+  XXH128_hash_t head;
+  XXH128_hash_t tail;
+  XXH128_hash_t full;
+};
+
+struct CacheHeader {
+  char magic[8];
+  std::uint64_t version;
+  std::uint64_t count;
+};
+
+
+// Persistent digest cache, keyed by (device, inode). Entries only count as hits while size, mtime and ctime still
+// match, so anything that changed simply gets rehashed and replaced.
+class HashCache {
+public:
+  explicit HashCache(std::string);
+  ~HashCache();
+  HashCache(const HashCache&) = delete;
+  HashCache& operator=(const HashCache&) = delete;
+
+  bool open();
+  bool save();
+  // Probe digests taken with any other hash don't count as hits
+  void set_probe_hash(HashKind);
+  // Full digests of files at least this long have to be segmented ones (0 for never)
+  void set_chunking(std::size_t);
+  bool lookup(const Task&, Stage, std::size_t, XXH128_hash_t&);
+  void store(const Task&, Stage, std::size_t, XXH128_hash_t);
+
+  std::size_t hits = 0;
+  std::size_t misses = 0;
+private:
+  const CacheEntry* find(const Task&);
+  auto full_kind(const Task&) const -> std::uint64_t;
+
+  std::string path;
+  HashKind probe_hash = HashKind::xxh3_64;
+  std::size_t chunk_threshold = 0;
+
+  // The mapped file from the last run
+  void* mapping = nullptr;
+  std::size_t mapping_size = 0;
+  const CacheEntry* entries = nullptr;
+  std::size_t count = 0;
+
+  // Digests computed during this run, written out by save()
+  std::map<std::tuple<std::uint64_t, std::uint64_t>, CacheEntry> updates;
+  std::mutex updates_mutex;
+};
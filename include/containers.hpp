@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+
+// Bounded multi-producer/multi-consumer queue (Dmitry Vyukov's design). Every cell carries a sequence number that
+// says whether it is ready to be written or read, so producers and consumers only ever contend on a single CAS.
+template <typename T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(std::size_t capacity) {
+    std::size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mask = size - 1;
+    cells.reset(new Cell[size]);
+    for (std::size_t ix = 0; ix < size; ++ix) {
+      cells[ix].sequence.store(ix, std::memory_order_relaxed);
+    }
+  }
+
+  // Returns false if the queue is full.
+  auto try_push(T value) -> bool {
+    std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &cells[pos & mask];
+      std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1)) {
+          break;
+        }
+      }
+      else if (diff < 0) {
+        return false;
+      }
+      else {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+    cell->data = std::move(value);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Returns false if the queue is empty.
+  auto try_pop(T& value) -> bool {
+    std::size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &cells[pos & mask];
+      std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos.compare_exchange_weak(pos, pos + 1)) {
+          break;
+        }
+      }
+      else if (diff < 0) {
+        return false;
+      }
+      else {
+        pos = dequeue_pos.load(std::memory_order_relaxed);
+      }
+    }
+    value = std::move(cell->data);
+    cell->sequence.store(pos + mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Only a hint, since it can be out of date by the time the caller looks at it.
+  auto empty() const -> bool {
+    return dequeue_pos.load() >= enqueue_pos.load();
+  }
+
+private:
+  struct Cell {
+    std::atomic<std::size_t> sequence;
+    T data;
+  };
+
+  std::unique_ptr<Cell[]> cells;
+  std::size_t mask;
+
+  // On their own cache lines, so producers and consumers don't bounce each other's
+  alignas(64) std::atomic<std::size_t> enqueue_pos = 0;
+  alignas(64) std::atomic<std::size_t> dequeue_pos = 0;
+};
+
+
+// Append-only table with stable addresses, so that elements can be handed around by index. One thread appends. Other
+// threads may read an element once its index has been passed to them through something that orders the accesses
+// (like a BoundedQueue). Segments are kept around by clear() and reused.
+template <typename T, std::size_t SegmentBits = 14, std::size_t MaxSegments = std::size_t(1) << 18>
+class SegmentedTable {
+public:
+  SegmentedTable() : segments(new std::unique_ptr<T[]>[MaxSegments]) {}
+
+  auto push(T value) -> std::size_t {
+    std::size_t ix = count;
+    std::unique_ptr<T[]>& segment = segments[ix >> SegmentBits];
+    if (!segment) {
+      segment.reset(new T[segment_size]);
+    }
+    segment[ix & segment_mask] = std::move(value);
+    count++;
+    return ix;
+  }
+
+  auto operator[](std::size_t ix) -> T& {
+    return segments[ix >> SegmentBits][ix & segment_mask];
+  }
+
+  auto size() const -> std::size_t {
+    return count;
+  }
+
+  void clear() {
+    count = 0;
+  }
+
+private:
+  static constexpr std::size_t segment_size = std::size_t(1) << SegmentBits;
+  static constexpr std::size_t segment_mask = segment_size - 1;
+
+  std::unique_ptr<std::unique_ptr<T[]>[]> segments;
+  std::size_t count = 0;
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#if XDUPES_XXH_DISPATCH
+// Points the XXH3 functions at xxHash's dispatcher, which picks SSE2, AVX2 or AVX-512 at runtime, whatever the binary
+// was compiled for. That needs the plain declarations (with xxhash.c linked in), not xxh3.h: it's only a shim that
+// turns on XXH_INLINE_ALL, which the dispatcher's renaming doesn't mix with.
+#include "xxhash.h"
+#include "xxh_x86dispatch.h"
+#else
+#include "xxh3.h"
+#endif
+
+
+// Which hash a stage is run with. Full hashes (and samples, which get reported) are always XXH3-128. The probes only
+// have to rule candidates out, so they can get away with something cheaper.
+enum class HashKind {
+  xxh3_64,
+  xxh3_128,
+  crc32c,
+};
+
+
+// Hasher policies. All of them have the same reset() / update() / digest(), so the code reading files can be
+// instantiated for each without caring which it got. Digests are widened to 128 bits (the high half is 0 for the
+// narrower ones), so results from any of them file the same way.
+class Xxh3_64 {
+public:
+  Xxh3_64() : state(XXH3_createState()) {
+    if (state == nullptr) {
+      abort();
+    }
+  }
+  ~Xxh3_64() { XXH3_freeState(state); }
+  Xxh3_64(const Xxh3_64&) = delete;
+  Xxh3_64& operator=(const Xxh3_64&) = delete;
+
+  void reset() {
+    if (XXH3_64bits_reset(state) == XXH_ERROR) {
+      abort();
+    }
+  }
+  void update(const void* data, std::size_t length) {
+    if (XXH3_64bits_update(state, data, length) == XXH_ERROR) {
+      abort();
+    }
+  }
+  auto digest() const -> XXH128_hash_t { return {XXH3_64bits_digest(state), 0}; }
+
+private:
+  XXH3_state_t* state;
+};
+
+class Xxh3_128 {
+public:
+  Xxh3_128() : state(XXH3_createState()) {
+    if (state == nullptr) {
+      abort();
+    }
+  }
+  ~Xxh3_128() { XXH3_freeState(state); }
+  Xxh3_128(const Xxh3_128&) = delete;
+  Xxh3_128& operator=(const Xxh3_128&) = delete;
+
+  void reset() {
+    if (XXH3_128bits_reset(state) == XXH_ERROR) {
+      abort();
+    }
+  }
+  void update(const void* data, std::size_t length) {
+    if (XXH3_128bits_update(state, data, length) == XXH_ERROR) {
+      abort();
+    }
+  }
+  auto digest() const -> XXH128_hash_t { return XXH3_128bits_digest(state); }
+
+private:
+  XXH3_state_t* state;
+};
+
+// CRC-32C (Castagnoli), with the SSE4.2 instruction when the CPU has it, and a table otherwise. Only 32 bits, so it's
+// only ever good for ruling files out, never for settling them.
+class Crc32c {
+public:
+  void reset() { crc = 0xffffffff; }
+  void update(const void* data, std::size_t length);
+  auto digest() const -> XXH128_hash_t { return {static_cast<XXH64_hash_t>(crc ^ 0xffffffff), 0}; }
+
+private:
+  std::uint32_t crc = 0xffffffff;
+};
+
+
+// One of each, for a worker that has to hash with whatever the current stage asks for
+struct Hashers {
+  Xxh3_64 xxh3_64;
+  Xxh3_128 xxh3_128;
+  Crc32c crc32c;
+
+  // Calls `function` with the hasher for `kind`. The function gets instantiated for each one, so whatever loop it runs
+  // is compiled against the concrete hasher, with no indirection per update.
+  template <class Function>
+  auto visit(HashKind kind, Function&& function) {
+    switch (kind) {
+      case HashKind::xxh3_64:
+        return function(xxh3_64);
+      case HashKind::crc32c:
+        return function(crc32c);
+      case HashKind::xxh3_128:
+        break;
+    }
+    return function(xxh3_128);
+  }
+};
+
+// What the hasher for `kind` is called, as given to --probe-hash
+auto hash_name(HashKind) -> const char*;
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+
+// Where a file's data starts on its device, for ordering reads on spinning disks. This is the physical offset of the
+// first extent when FIEMAP knows it. Otherwise it's the inode number with the top bit set, so those files sort after
+// every file with a known extent, and still roughly in allocation order among themselves. `fd` may be -1, for a file
+// that couldn't be opened.
+auto locate(int fd, std::uint64_t ino) -> std::uint64_t;
+
+// Whether a device is a spinning disk, going by /sys/dev/block. Anything that isn't a block device (tmpfs, NFS, ...)
+// counts as not rotational.
+auto is_rotational(std::uint64_t dev) -> bool;
+
+// "major:minor", the way the kernel names a device in sysfs and in /proc.
+auto device_name(std::uint64_t dev) -> std::string;
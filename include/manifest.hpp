@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "paths.hpp"
+#include "threadpool.hpp"
+
+
+// A manifest is every candidate one scan hashed, sorted by (size, digest), so that scans of different hosts can be
+// merged later without touching any file data (see --manifest-out and --merge).
+//
+// The layout is
+//   header | host name | file names | directory paths | directory index | entries
+// Names are NUL terminated and back to back. A directory is a u32 length and its path, and the index holds the
+// offset of every directory, so an entry's path is two small reads away. Entries are fixed size, and come last so
+// that they can be streamed. Everything is native endian; the header's byte order mark makes a manifest from a host
+// with the other byte order fail to open instead of being misread. The header also says how the full digests were
+// taken, since files from --chunk-threshold up get a tree digest: manifests only merge if they agree on that.
+namespace manifest {
+
+struct Header {
+  char magic[8];
+  std::uint32_t byte_order;
+  std::uint32_t entry_size;
+  std::uint64_t entries;
+  std::uint64_t entries_offset;
+  std::uint64_t dirs;
+  std::uint64_t dir_index_offset;
+  std::uint64_t names_offset;
+  std::uint64_t host_size;
+  // Which digests the entries hold. Tree digests over `chunk_segment` byte segments for files of at least
+  // `chunk_threshold` bytes (0 for none), single-stream XXH3-128 for the rest.
+  std::uint32_t digest_scheme;
+  std::uint32_t reserved;
+  std::uint64_t chunk_threshold;
+  std::uint64_t chunk_segment;
+};
+
+// One candidate. The probes are the low halves of its head and tail digests (0 if that probe didn't run).
+struct Entry {
+  std::uint64_t size;
+  std::uint64_t low;
+  std::uint64_t high;
+  std::uint64_t head;
+  std::uint64_t tail;
+  std::uint64_t dev;
+  std::uint64_t ino;
+  // Offset into the names
+  std::uint64_t name;
+  std::uint32_t dir;
+  std::uint32_t reserved;
+};
+
+static_assert(sizeof(Header) == 88);
+static_assert(sizeof(Entry) == 72);
+
+auto operator<(const Entry&, const Entry&) -> bool;
+
+
+// Collects the candidates of one scan as their digests come in, and writes them out sorted at the end.
+class Writer {
+public:
+  Writer(std::string path, std::uint64_t chunk_threshold);
+  void add(const Task&);
+  // Written under a temporary name and renamed into place, so a manifest is either complete or not there
+  bool write(const PathTable&, const std::string& host);
+private:
+  std::string path;
+  std::uint64_t chunk_threshold;
+  // `dir` and `name` point into the PathTable until write() renumbers them
+  std::vector<Entry> entries;
+};
+
+
+// Reads a manifest's entries front to back, a block at a time, so only paths ever need random access.
+class Reader {
+public:
+  explicit Reader(std::string path);
+  ~Reader();
+  Reader(const Reader&) = delete;
+  Reader& operator=(const Reader&) = delete;
+  Reader(Reader&&) noexcept;
+
+  bool open();
+  bool next(Entry&);
+  auto path(const Entry&) -> std::string;
+  // Whether both have digests taken the same way, so that equal files have equal digests
+  bool same_digests(const Reader&) const;
+  auto chunk_threshold() const -> std::uint64_t;
+
+  std::string host;
+  std::string file;
+  // Why open() failed
+  std::string error;
+  // A block of entries couldn't be read
+  bool failed = false;
+private:
+  bool read(void*, std::size_t, std::uint64_t);
+
+  int fd = -1;
+  Header header;
+  std::vector<Entry> block;
+  std::size_t cursor = 0;
+  std::uint64_t consumed = 0;
+};
+
+
+// Streaming k-way merge of sorted manifests by (size, digest). Every group of equal entries that spans more than one
+// manifest goes to `found` an entry at a time, as (manifest, entry, whether it starts a new group), in the order the
+// manifests were given. Only one block per manifest is ever held in memory, however big a group gets. Manifests whose digests were taken differently can't be merged. Returns false, with `error` saying why,
+// if they were, or if a manifest couldn't be read to the end.
+bool merge(std::vector<Reader>&, const std::function<void(std::size_t, const Entry&, bool)>& found, std::string& error);
+
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+
+
+// How feeding from a mapping went. `unmapped` means mmap() itself was refused (some FUSE and network filesystems do),
+// before anything was fed, so the caller can just read() instead. `truncated` means the file shrank from under us
+// partway through, and whatever was fed is garbage.
+enum class Mapped {
+  complete,
+  unmapped,
+  truncated,
+};
+
+// Hand part of a file to `feed` straight out of a read-only mapping, without copying it into a buffer first.
+auto feed_mapped(int fd, std::size_t offset, std::size_t length, void (*feed)(void*, const void*, std::size_t), void* context) -> Mapped;
+
+// Same, into any hasher from hasher.hpp
+template <class Hasher>
+auto hash_mapped(int fd, std::size_t offset, std::size_t length, Hasher& hasher) -> Mapped {
+  auto feed = [](void* context, const void* data, std::size_t size) { static_cast<Hasher*>(context)->update(data, size); };
+  return feed_mapped(fd, offset, length, feed, &hasher);
+}
+
+// Touching a mapped page past the end of a truncated file raises SIGBUS. This turns that into an error return from
+// feed_mapped() instead of a crash. Call it once, before any thread maps anything.
+void install_sigbus_handler();
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+// What a thread counts. `stats` and `opens` are syscalls, `reads` is read()s (or reads queued on a ring), and
+// `idle_ns` is time spent parked with nothing to do.
+enum class Counter : std::size_t {
+  files,
+  bytes,
+  dirs,
+  opens,
+  stats,
+  reads,
+  idle_ns,
+};
+
+constexpr std::size_t counter_count = 7;
+
+using CounterValues = std::array<std::uint64_t, counter_count>;
+
+
+// One thread's counters. Only the owning thread ever writes them, so a relaxed load and store does the job without a
+// locked instruction, while anyone can still read them at any time. Padded so neighbouring threads don't share a line.
+struct alignas(64) ThreadCounters {
+  void add(Counter, std::uint64_t = 1);
+  void idle_begin();
+  void idle_end();
+  // Current values, with an idle stretch that is still going on counted up to now
+  auto snapshot() const -> CounterValues;
+
+  std::array<std::atomic<std::uint64_t>, counter_count> values = {};
+  std::atomic<std::uint64_t> idle_since = 0;
+};
+
+
+// Metrics for a whole run, split into phases (parsing, the walk, each hashing stage, ...). A phase gets the difference
+// in its threads' counters between its start and end, its queue depth sampled every few milliseconds, and whatever
+// extra numbers get noted on it. Starting a phase that already ran picks it up again, so work done in several batches
+// still adds up to one phase. The lot can be written out as JSON at exit, and on SIGUSR1 while running.
+class Metrics {
+public:
+  struct Phase {
+    std::string name;
+    bool running = false;
+    // When it was last started, and how long it ran before that
+    std::uint64_t start_ns = 0;
+    std::uint64_t accumulated_ns = 0;
+    std::vector<const ThreadCounters*> sources;
+    std::vector<CounterValues> first;
+    // Per thread, up to the last time the phase was stopped
+    std::vector<CounterValues> deltas;
+    std::function<std::size_t()> depth;
+    // (ms since the phase started, depth). Thinned out as it grows, so it stays small for long phases.
+    std::vector<std::pair<std::uint64_t, std::size_t>> samples;
+    std::uint64_t sample_every_ns = 10'000'000;
+    // Summed over every time the phase ran
+    std::vector<std::pair<std::string, double>> notes;
+
+    auto elapsed() const -> std::uint64_t;
+    auto total(Counter) const -> std::uint64_t;
+    auto noted(const std::string&) const -> double;
+    auto per_thread() const -> std::vector<CounterValues>;
+  };
+
+  Metrics();
+  ~Metrics();
+  Metrics(const Metrics&) = delete;
+  Metrics& operator=(const Metrics&) = delete;
+
+  void begin(const std::string&, std::vector<const ThreadCounters*> = {}, std::function<std::size_t()> = {});
+  void note(const std::string&, double);
+  void set(const std::string&, double);
+  void end();
+
+  // Phases are only ever added, and only by the thread that calls begin(), so that thread may look at them freely.
+  auto phase(const std::string&) const -> const Phase*;
+  auto elapsed() const -> std::uint64_t;
+  auto json() -> std::string;
+
+  // Write the JSON to `path` ("-" for stderr) whenever SIGUSR1 arrives, and from write(). Starts the sampler.
+  void report_to(const std::string&);
+  bool write();
+
+private:
+  void sample();
+  void finish(Phase&);
+  auto render(const Phase&, std::uint64_t) const -> std::string;
+
+  std::uint64_t start_ns = 0;
+  std::vector<Phase> phases;
+  // Index of the running phase, if any
+  std::size_t current = 0;
+  bool active = false;
+  mutable std::mutex mutex;
+
+  std::string path;
+  // Held for the whole of write(), so a SIGUSR1 report and the final one can't both be writing the temporary file
+  std::mutex write_mutex;
+  std::thread sampler;
+  std::atomic<bool> stopping = false;
+  std::mutex sampler_mutex;
+  std::condition_variable sampler_wake;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "paths.hpp"
+#include "threadpool.hpp"
+
+
+// How duplicate groups get written out.
+//
+// `text` is one path per line (or NUL terminated, with --zero) and an empty line after every group, with a file's
+// hardlinks right after it. Nothing else goes in it, so probable groups look like any other there. `jsonl` is one JSON
+// object per group, with its size, digest and every file's device, inode and hardlinks. `csv` is one row per path, with
+// a header; hardlinks share the device and inode of the file they're a link to. `binary` is the compact manifest
+// described below.
+enum class OutputFormat {
+  text,
+  jsonl,
+  csv,
+  binary,
+};
+
+
+// Collects output in one big buffer and hands it to the kernel with a single write() when it fills up, or when asked
+// to. Only ever used from one thread, so there's no locking of any kind, and nothing goes through iostreams.
+class OutputBuffer {
+public:
+  explicit OutputBuffer(int fd, std::size_t capacity = std::size_t(1) << 20);
+  ~OutputBuffer();
+  OutputBuffer(const OutputBuffer&) = delete;
+  OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+  void append(const char*, std::size_t);
+  void append(const std::string&);
+  void put(char);
+  // Whatever std::cout has buffered goes out first, so the two never get interleaved out of order
+  bool flush();
+
+private:
+  int fd;
+  std::vector<char> buffer;
+  std::size_t used = 0;
+  bool failed = false;
+};
+
+
+// Writes duplicate groups in one of the formats above.
+//
+// The binary manifest is little endian throughout. It starts with the 8 bytes "XDUPES\0\1", and then every
+// group is
+//   u64 size, u64 digest low, u64 digest high, u8 flags (1: probable only, 2: no digest), u32 file count
+// followed by every file in it as
+//   u64 device, u64 inode, u32 path count, and that many (u32 length, path bytes)
+// where the first path is the file's, and the rest are hardlinks to it.
+class ResultWriter {
+public:
+  ResultWriter(OutputFormat, char separator, const PathTable&, OutputBuffer&);
+
+  // `probable` marks a group found by sampling only. A digest of 0 means the group has none that covers every byte
+  // (it was settled by a probe, or by --verify).
+  void group(const std::vector<Task>&, bool probable);
+  // Writes the header, if nothing else has yet
+  void header();
+
+private:
+  void text(const std::vector<Task>&);
+  void jsonl(const std::vector<Task>&, bool, bool);
+  void csv(const std::vector<Task>&, bool, bool);
+  void csv_row(const Task&, const std::string&, bool, bool);
+  void binary(const std::vector<Task>&, bool, bool);
+
+  auto path(PathRef) -> const std::string&;
+  void number(std::uint64_t);
+  void digest(const Task&);
+  void quoted(const std::string&);
+  void integer(std::uint64_t, std::size_t);
+
+  OutputFormat format;
+  char separator;
+  const PathTable& paths;
+  OutputBuffer& out;
+  bool started = false;
+  std::uint64_t groups = 0;
+  // (directory, its path), and the last path built
+  std::vector<std::pair<std::uint32_t, std::string>> dirs;
+  std::string scratch;
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+
+// Where a file lives: the directory it's in, and where its name starts in the name arena. A full path is only ever
+// built when something has to be printed.
+struct PathRef {
+  std::uint32_t dir = 0;
+  std::uint64_t name = 0;
+};
+
+
+// Every directory and file name seen by the walk. Directories are interned once, as (parent, name), so that a million
+// files in one directory share a single copy of its path. File names live back to back in fixed-size chunks,
+// NUL-terminated, and every thread fills chunks of its own.
+//
+// Anything may be added and looked up by any thread. Directories (and new chunks) are rare enough next to files that
+// the lock around them is never contended. Chunks never move, so a name can be read by whoever it gets handed to while
+// its thread keeps adding more.
+class PathTable {
+public:
+  static constexpr std::uint32_t no_parent = std::numeric_limits<std::uint32_t>::max();
+
+  // The chunk one thread is currently filling
+  struct Arena {
+    char* chunk = nullptr;
+    std::uint64_t base = 0;
+    std::size_t used = 0;
+  };
+
+  auto add_dir(std::uint32_t parent, std::string name) -> std::uint32_t;
+  auto add_name(Arena&, const char*) -> std::uint64_t;
+  auto dir_path(std::uint32_t dir) const -> std::string;
+  auto name(PathRef ref) const -> const char*;
+  auto path(PathRef ref) const -> std::string;
+
+private:
+  static constexpr std::size_t chunk_bits = 16;
+  static constexpr std::size_t chunk_size = std::size_t(1) << chunk_bits;
+
+  // `name` is an offset into `dir_names`
+  struct Dir {
+    std::uint32_t parent;
+    std::uint64_t name;
+  };
+
+  std::vector<Dir> dirs;
+  std::vector<char> dir_names;
+  std::vector<std::unique_ptr<char[]>> chunks;
+  mutable std::shared_mutex mutex;
+};
+
+
+// A small per-thread cache of open directory handles, so that files can be opened with openat() relative to their
+// directory instead of having the kernel walk the whole path again every time. Direct mapped on the directory id,
+// which works well since the walk hands out files a directory at a time.
+class DirHandles {
+public:
+  explicit DirHandles(const PathTable&, std::size_t = 64);
+  ~DirHandles();
+  DirHandles(const DirHandles&) = delete;
+  DirHandles& operator=(const DirHandles&) = delete;
+
+  // Same as open(2), with the same return value and errno
+  auto open(PathRef, int) -> int;
+  // The directory's own (O_PATH) handle for the *at() calls, or -1 if it can't be opened. Still owned by the cache.
+  auto dir(std::uint32_t) -> int;
+
+private:
+  struct Slot {
+    std::uint32_t dir = PathTable::no_parent;
+    int fd = -1;
+  };
+
+  const PathTable& paths;
+  std::vector<Slot> slots;
+};
@@ -1,10 +1,16 @@
 #pragma once
 
-#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
 #include <iostream>
-#include <sstream>
+#include <mutex>
+#include <string>
 #include <sys/ioctl.h>
 #include <termios.h>
+#include <thread>
 
 
 
@@ -19,6 +25,9 @@ public:
 
   ProgressBar(std::size_t);
 
+  // Keep the terminal width cached, and only ask for it again on SIGWINCH
+  static void watch_terminal();
+
   void update_terminal_size();
   void set_progress(std::size_t amount);
   void reset();
@@ -28,3 +37,51 @@ public:
   void set_prefix(const std::string&);
   void set_suffix(const std::string&);
 };
+
+
+// Draws progress from a thread of its own, a fixed number of times a second, by calling whatever it was given to
+// show. The threads doing the actual work only ever bump relaxed atomics, and never wait on the terminal.
+class ProgressReporter {
+public:
+  // Where a phase is at. Either total may be 0 if it isn't known.
+  struct Sample {
+    std::size_t done = 0;
+    std::size_t total = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t bytes_total = 0;
+  };
+
+  explicit ProgressReporter(bool binary, std::chrono::milliseconds every = std::chrono::milliseconds(100));
+  ~ProgressReporter();
+  ProgressReporter(const ProgressReporter&) = delete;
+  ProgressReporter& operator=(const ProgressReporter&) = delete;
+
+  // A bar, with throughput and an ETA from the bytes left to read
+  void show(const std::string& label, std::function<Sample()>);
+  // A line of text, for phases with nothing to measure against (like the walk)
+  void show(std::function<std::string()>);
+  // Stop drawing and clear the line. Nothing gets drawn once this returns, so the caller may write to the terminal.
+  void hide();
+
+private:
+  void run();
+  void draw();
+
+  bool binary;
+  std::chrono::milliseconds every;
+  ProgressBar bar{0};
+
+  // Everything below is only touched under `mutex`
+  std::function<Sample()> sample;
+  std::function<std::string()> text;
+  bool shown = false;
+  // Smoothed bytes per second, and where the last draw was at
+  double rate = 0;
+  std::uint64_t last_bytes = 0;
+  std::chrono::steady_clock::time_point last_time;
+
+  std::thread thread;
+  bool stopping = false;
+  std::mutex mutex;
+  std::condition_variable wake;
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "paths.hpp"
+
+
+// What --replace does to a duplicate. `hardlink` and `symlink` swap the path for a link to the kept file, and
+// `reflink` leaves the path alone and has the filesystem share the kept file's extents with it instead.
+enum class ReplaceMode {
+  hardlink,
+  symlink,
+  reflink,
+};
+
+// One path to replace, and how that went
+struct Replacement {
+  enum class Outcome {
+    pending,
+    done,
+    failed,
+    // reflink only: the kernel compared the bytes and they weren't the same after all
+    differs,
+    // reflink only: the filesystem can't share extents
+    unsupported,
+  };
+
+  std::string kept;
+  PathRef target;
+  std::uint64_t dev = 0;
+  std::size_t size = 0;
+  Outcome outcome = Outcome::pending;
+  int error = 0;
+};
+
+
+// Replaces duplicates in parallel. Jobs are split up by the directory they're in, so a directory only ever has one
+// thread working in it, and threads never fight over the same directory's lock.
+//
+// Links are never missing for a moment: the new link is made under a temporary name in the same directory, then
+// renamed over the duplicate, which replaces it atomically. A crash in between leaves at worst a stray
+// `.xdupes-*.tmp` link next to an untouched duplicate.
+class Replacer {
+public:
+  Replacer(std::size_t threads, ReplaceMode, const PathTable&);
+  // Blocks until every job has an outcome. `progress` (if any) gets called from this thread every few milliseconds
+  // with how many are done.
+  void run(std::vector<Replacement>&, const std::function<void(std::size_t)>& = {});
+private:
+  void replace(Replacement&, DirHandles&);
+  void link(Replacement&, DirHandles&);
+  void dedupe(Replacement&, DirHandles&);
+
+  std::size_t max_workers = 1;
+  ReplaceMode mode;
+  const PathTable& paths;
+  // Symlinks have to point at an absolute path, and the walk's paths may be relative to here
+  std::string cwd;
+  std::atomic<std::size_t> done = 0;
+  std::atomic<std::uint64_t> temporaries = 0;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "hasher.hpp"
+
+
+// One digest, as filed by a worker: the candidate group it was hashed in, the full 128-bit digest, and the task's
+// index in the pool's task table.
+struct Result {
+  std::uint64_t group;
+  XXH64_hash_t low;
+  XXH64_hash_t high;
+  std::uint64_t index;
+};
+
+
+// Digests for one stage, grouped by (group, digest).
+//
+// While the stage runs, every worker appends to its own shard, so filing a result is a vector push with no locking.
+// Once the stage is over, merge() makes a single pass over every shard with an open-addressing (linear probing)
+// index, and lays the task indices out so that each key's members are contiguous.
+//
+// Memory per file is 32 bytes in a shard while hashing. merge() briefly adds about 24 more (8 for the task index in
+// its final place, 4 for its key, and 8 for its two slots in the probe table), plus 16 per distinct key. The old
+// nested std::map spent two tree nodes per digest (~100 bytes with allocator overhead) plus a full copy of the path.
+class ResultTable {
+public:
+  // The task indices that share one key
+  struct Members {
+    const std::size_t* first;
+    const std::size_t* last;
+    auto begin() const -> const std::size_t* { return first; }
+    auto end() const -> const std::size_t* { return last; }
+    auto size() const -> std::size_t { return last - first; }
+  };
+
+  void resize(std::size_t);
+  void add(std::size_t shard, std::size_t group, XXH128_hash_t hash, std::size_t index);
+  void merge();
+  void clear();
+
+  // Only valid after merge()
+  auto size() const -> std::size_t;
+  auto members(std::size_t key) const -> Members;
+  auto digest(std::size_t key) const -> XXH128_hash_t;
+
+private:
+  // Padded so that workers appending to neighbouring shards don't share a cache line
+  struct alignas(64) Shard {
+    std::vector<Result> records;
+  };
+
+  std::vector<Shard> shards;
+
+  // Key k's members are indices[offsets[k]] up to indices[offsets[k + 1]]
+  std::vector<std::size_t> indices;
+  std::vector<std::size_t> offsets;
+  std::vector<XXH128_hash_t> digests;
+};
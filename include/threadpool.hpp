@@ -1,40 +1,226 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
 #include <fstream>
 #include <future>
 #include <iostream>
 #include <map>
-#include <queue>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <vector>
 
-#include "xxh3.h"
+#include "containers.hpp"
+#include "hasher.hpp"
+#include "logging.hpp"
+#include "metrics.hpp"
+#include "paths.hpp"
+#include "results.hpp"
 
 
-// Thread pool manager
+// Which part of a file the workers hash. Probes only read a small block, so most
+// same-size files can be told apart without reading them end to end. `sample` hashes a
+// few blocks spread evenly over the file, along with its size, which makes for a cheap
+// fingerprint of a huge file, but not a proof that two of them are the same.
+enum class Stage {
+  head,
+  tail,
+  sample,
+  full,
+};
+
+// Files at or above the chunk threshold (--chunk-threshold) get their full digest from a tree over the digests of
+// segments this long, so several workers can hash one huge file at once. Fixed, so that the digest doesn't depend on
+// how many workers there were.
+constexpr std::size_t chunk_segment = 64 * 1024 * 1024;
+
+// Identity of a file on disk, filled in by the walker. An inode of 0 means unknown.
+struct FileKey {
+  std::uint64_t dev = 0;
+  std::uint64_t ino = 0;
+  std::uint64_t mtime_ns = 0;
+  std::uint64_t ctime_ns = 0;
+};
+
+// A file to hash, along with the candidate group it currently belongs to. Hardlinks to the same inode are collapsed
+// into one task by the walker, and the other paths ride along in `links`. Paths are looked up in the walker's
+// PathTable.
+struct Task {
+  PathRef path;
+  std::size_t group;
+  std::size_t size;
+  FileKey key;
+  std::vector<PathRef> links;
+  // Sort key for reading in on-disk order (see layout.hpp). Only filled in when that's turned on, by whichever worker
+  // opens the file first.
+  std::uint64_t location = 0;
+  // What the last stage it went through hashed it to
+  XXH128_hash_t digest = {0, 0};
+  // Low halves of the head and tail digests, for --manifest-out
+  std::array<std::uint64_t, 2> probes = {};
+};
+
+// How the workers read files. `uring` keeps several reads in flight per worker, across several files.
+enum class IoEngine {
+  sync,
+  uring,
+};
+
+class HashCache;
+
+// Thread pool manager. Tasks live in `table`, and only their indices travel through the queues. Every device gets a
+// queue of its own, along with a limit on how many of its files the (shared) workers may be reading at once, so a slow
+// disk can only ever tie up its own share of the workers.
 class ThreadPool {
 public:
   ThreadPool(std::size_t);
   void start();
-  void enqueue(const std::string&);
+  void set_stage(Stage, std::size_t);
+  void set_cache(HashCache*);
+  void set_paths(const PathTable*);
+  void set_io(IoEngine, std::size_t);
+  void set_mmap_threshold(std::size_t);
+  void set_sampling(std::size_t, std::size_t);
+  void set_probe_hash(HashKind);
+  void set_autotune(bool);
+  void set_chunking(std::size_t);
+  void set_locating(bool);
+  auto chunks(const Task&) const -> bool;
+  auto tuned() -> std::size_t;
+  auto stage_of(const Task&) const -> Stage;
+  auto hash_of(const Task&) const -> HashKind;
+  void set_devices(const std::vector<std::pair<std::uint64_t, std::size_t>>&);
+  std::size_t enqueue(Task);
+  std::size_t record(Task, XXH128_hash_t);
+  Task& task(std::size_t);
+  void reset();
   void stop();
   bool busy();
   void join();
-  std::map<XXH64_hash_t, std::map<XXH64_hash_t, std::vector<std::string>>> results;
-  std::size_t total_done = 0;
-  std::mutex total_mutex;
+  auto counters() const -> std::vector<const ThreadCounters*>;
+  auto depth() const -> std::size_t;
+  auto completed() const -> std::size_t;
+  auto bytes_read() const -> std::uint64_t;
+  auto reads(const Task&) const -> std::size_t;
+  // Indices into the task table, grouped by (group, digest) once join() returns
+  ResultTable results;
 private:
-  void loop();
+  // One device's queue. `limit` is how many of its files may be in flight at once (0 for no limit).
+  struct alignas(64) Lane {
+    Lane(std::uint64_t dev, std::size_t limit) : dev(dev), limit(limit) {}
+    std::uint64_t dev;
+    std::size_t limit;
+    BoundedQueue<std::size_t> tasks{65536};
+    std::atomic<std::size_t> active = 0;
+  };
+
+  // A file being hashed in segments. The worker that finishes its last segment puts the digest together.
+  struct ChunkedFile {
+    ChunkedFile(std::size_t task, std::size_t count) : task(task), digests(count), remaining(count) {}
+    std::size_t task;
+    std::vector<XXH128_hash_t> digests;
+    std::atomic<std::size_t> remaining;
+    std::atomic<bool> complete = true;
+  };
+
+  struct Segment {
+    ChunkedFile* file = nullptr;
+    std::size_t number = 0;
+  };
+
+  // Queue entries with this bit set are indices into `segments`, not into `table`
+  static constexpr std::size_t segment_flag = std::size_t(1) << (sizeof(std::size_t) * 8 - 1);
+
+  void loop(std::size_t);
+  void loop_uring(std::size_t);
+  template <class Hasher>
+  auto hash_file(Hasher&, Task&, char*, std::size_t, ThreadCounters&, DirHandles&) -> std::pair<XXH128_hash_t, bool>;
+  auto hash_segment(Xxh3_128&, std::size_t, char*, std::size_t, ThreadCounters&, DirHandles&) -> std::pair<XXH128_hash_t, bool>;
+  template <class Hasher>
+  auto read_range(Hasher&, int, std::size_t, std::size_t, char*, std::size_t, ThreadCounters&) -> bool;
+  void push(Lane&, std::size_t);
+  bool next(std::size_t, std::size_t&, bool);
+  bool ready();
+  bool claim(Lane&);
+  void release(Lane&);
+  Lane& lane(std::uint64_t);
+  std::size_t parts(const Task&) const;
+  std::pair<std::size_t, std::size_t> range(const Task&, std::size_t) const;
+  void file(std::size_t, std::size_t, XXH128_hash_t);
+  void finish(std::size_t, std::size_t, XXH128_hash_t, bool);
+  void finish_segment(std::size_t, std::size_t, XXH128_hash_t, bool);
+  void deliver(std::size_t, std::size_t, XXH128_hash_t, bool);
+  void tune();
+  void resize(std::size_t);
   std::size_t max_workers = 1;
+  logging::Logger& logger;
   std::vector<std::thread> threads;
-  std::queue<std::string> tasks;
+  std::vector<ThreadCounters> worker_counters;
+
+  // Only appended to by the thread that enqueues
+  SegmentedTable<Task> table;
+  SegmentedTable<Segment> segments;
+  // A deque, so that segments can point into it while it grows
+  std::deque<ChunkedFile> chunked;
+
+  // Full hashes of files at least this long are done in segments. 0 means never.
+  std::size_t chunk_threshold = 0;
+
+  // Set up before start(), and fixed from then on. The last lane takes every device that wasn't given one.
+  std::vector<std::pair<std::uint64_t, std::size_t>> devices;
+  std::vector<std::unique_ptr<Lane>> lanes;
+
+  // Only changed between stages, while the pool is idle
+  Stage stage = Stage::full;
+  std::size_t block_size = 0;
+  HashKind probe_hash = HashKind::xxh3_64;
 
-  bool should_terminate = false;
+  // Where freshly computed digests get remembered, if anywhere
+  HashCache* cache = nullptr;
 
-  std::mutex tasks_mutex;
-  std::mutex results_mutex;
+  // Where the tasks' paths live
+  const PathTable* paths = nullptr;
 
+  IoEngine engine = IoEngine::sync;
+  std::size_t queue_depth = 8;
+
+  // Ranges at least this long get hashed through mmap() instead of read(). 0 means never.
+  std::size_t mmap_threshold = 0;
+
+  // Whether workers look up where a file's data is while they have it open anyway
+  bool locating = false;
+
+  // How many blocks the sample stage reads, and the smallest file it bothers sampling
+  std::size_t sample_blocks = 0;
+  std::size_t sample_threshold = 0;
+
+  // Tasks that have been queued but not yet finished. join() sleeps on `done` until this hits zero.
+  std::atomic<std::size_t> pending = 0;
+  // Tasks with a digest since the last reset(), for progress. Relaxed, since nothing gets ordered by it.
+  std::atomic<std::size_t> finished = 0;
+  std::mutex done_mutex;
+  std::condition_variable done;
+
+  // Workers only park on `condition` when there is nothing they're allowed to take, so enqueue() and release() only
+  // have to touch `idle_mutex` when someone is actually asleep.
+  std::atomic<std::size_t> sleepers = 0;
+  std::atomic<bool> should_terminate = false;
+  std::mutex idle_mutex;
   std::condition_variable condition;
+
+  // With --threads auto, every worker gets started, but only the first `active_workers` take tasks. The rest wait on
+  // `parked` (under `idle_mutex`, which is also held to change the count) until the tuner lets them back in.
+  bool autotune = false;
+  std::atomic<std::size_t> active_workers = 0;
+  std::condition_variable parked;
+  std::thread tuner;
+  std::mutex tune_mutex;
+  std::condition_variable tune_wake;
+  // How many of the tuner's windows this stage ran at each worker count
+  std::vector<std::size_t> windows_at;
 };
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+
+// Bare-bones io_uring wrapper, talking to the kernel directly so that we don't need liburing. Only does what the
+// hashing workers need: queue up reads, submit them, and reap completions. One ring per thread, never shared.
+class Ring {
+public:
+  Ring() = default;
+  ~Ring();
+  Ring(const Ring&) = delete;
+  Ring& operator=(const Ring&) = delete;
+
+  bool init(unsigned entries);
+  bool prepare_read(int fd, const iovec* iov, std::uint64_t offset, std::uint64_t data);
+  bool submit_and_wait(unsigned wait);
+  bool peek(std::uint64_t& data, std::int32_t& res);
+
+  // Whether the running kernel (and seccomp policy) lets us set up a ring at all
+  static bool supported();
+private:
+  int ring_fd = -1;
+
+  void* sq_ptr = nullptr;
+  std::size_t sq_size = 0;
+  void* cq_ptr = nullptr;
+  std::size_t cq_size = 0;
+  io_uring_sqe* sqes = nullptr;
+  std::size_t sqes_size = 0;
+
+  unsigned* sq_head = nullptr;
+  unsigned* sq_tail = nullptr;
+  unsigned* sq_array = nullptr;
+  unsigned sq_mask = 0;
+  unsigned sq_entries = 0;
+
+  unsigned* cq_head = nullptr;
+  unsigned* cq_tail = nullptr;
+  io_uring_cqe* cqes = nullptr;
+  unsigned cq_mask = 0;
+
+  // Prepared but not yet handed to the kernel
+  unsigned to_submit = 0;
+};
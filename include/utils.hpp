@@ -13,17 +13,6 @@
 void restore_terminal(int s);
 
 
-// Just a blob of data
-struct TimeStats {
-  std::size_t proc_start;
-  std::size_t parsing;
-  std::size_t filesystem;
-  std::size_t hashing;
-  std::size_t overall;
-  std::size_t proc_stop;
-};
-
-
 // Some timing utilities
 auto now() -> std::size_t;
 
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "metrics.hpp"
+#include "paths.hpp"
+#include "threadpool.hpp"
+
+
+// Byte-for-byte comparison of same-size candidates. Every member of a group is read in lockstep, one chunk at a time,
+// and the group is split the moment its members' chunks stop matching. Files that end up on their own are dropped
+// right away, so they aren't read any further. Nothing is ever read twice.
+class Verifier {
+public:
+  Verifier(std::size_t threads, std::size_t max_open, const PathTable&);
+  auto verify(std::vector<std::vector<Task>>) -> std::vector<std::vector<Task>>;
+  auto counters() const -> std::vector<const ThreadCounters*>;
+private:
+  struct Member {
+    Task task;
+    int fd = -1;
+  };
+
+  void split(std::vector<Member>, std::vector<std::vector<Task>>&, std::size_t, ThreadCounters&, DirHandles&);
+  bool read(Member&, std::size_t, std::size_t, char*, std::size_t&, std::size_t, ThreadCounters&, DirHandles&);
+  void release(Member&, std::size_t&);
+
+  std::size_t max_workers = 1;
+  // File descriptors that may be kept open between chunks, across all threads
+  std::size_t max_open = 256;
+  std::vector<ThreadCounters> worker_counters;
+  const PathTable& paths;
+};
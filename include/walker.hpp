@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "logging.hpp"
+#include "metrics.hpp"
+#include "paths.hpp"
+#include "threadpool.hpp"
+#include "utils.hpp"
+
+
+// How the walker lists directories. `getdents` goes straight to the syscalls, and `filesystem` uses
+// std::filesystem, which costs a few more stats per entry.
+enum class WalkEngine {
+  getdents,
+  filesystem,
+};
+
+// Parallel directory walker. Every thread has its own deque of directories, and its own list of files and chunk of
+// names. Threads pop from the back of their own deque, and steal from the front of everyone else's once they run dry.
+// Once the walk is over, everything is merged into `files` (sorted by size), and paths that are hardlinks to the same
+// inode get collapsed into a single candidate.
+//
+// When streaming, files are handed over through take() a directory at a time while the walk is still going, and are
+// left as they are: `files` stays empty, and hardlinks are up to whoever takes them.
+class Walker {
+public:
+  Walker(std::size_t, bool, WalkEngine = WalkEngine::getdents);
+  void set_streaming(bool);
+  void start(const std::deque<std::string>&);
+  bool busy();
+  void join();
+  std::size_t walked();
+  auto counters() const -> std::vector<const ThreadCounters*>;
+  auto depth() const -> std::size_t;
+  bool take(std::vector<Task>&);
+  // Every file found, sorted by size, so a run of equal sizes is a bucket of candidates
+  std::vector<Task> files;
+  PathTable paths;
+  // How many paths were folded into another path's `links`
+  std::size_t collapsed = 0;
+private:
+  // Padded so that the threads don't fight over cache lines
+  struct alignas(64) Shard {
+    std::mutex mutex;
+    std::deque<std::uint32_t> dirs;
+    std::vector<Task> files;
+    // Files from finished directories, waiting for take(). Guarded by `mutex`, like `dirs`.
+    std::vector<Task> outbox;
+    PathTable::Arena names;
+    // Where getdents64() puts its entries
+    std::vector<char> buffer;
+    ThreadCounters counters;
+  };
+
+  void loop(std::size_t);
+  void scan(Shard&, std::uint32_t);
+  void scan_getdents(Shard&, std::uint32_t);
+  void add_file(Shard&, std::uint32_t, const char*, std::size_t, const FileKey&);
+  void push(Shard&, std::uint32_t);
+  bool pop(std::size_t, std::uint32_t&);
+  void collapse();
+
+  std::size_t max_workers = 1;
+  bool recursive = false;
+  WalkEngine engine = WalkEngine::getdents;
+  bool streaming = false;
+  std::vector<Shard> shards;
+  std::vector<std::thread> threads;
+
+  // Directories that have been pushed but not yet fully scanned. Zero means the walk is over.
+  std::atomic<std::size_t> outstanding = 0;
+  // Directories sitting in some deque, waiting for a thread to pop them
+  std::atomic<std::size_t> queued = 0;
+
+  // Threads with nothing to pop park on `idle` until push() has something for them, or the walk is over. Like the
+  // pool, push() only touches `idle_mutex` when someone is actually asleep.
+  std::atomic<std::size_t> sleepers = 0;
+  std::mutex idle_mutex;
+  std::condition_variable idle;
+
+  logging::Logger& logger;
+};
@@ -0,0 +1,217 @@
+#include "cache.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static constexpr char cache_magic[8] = {'x', 'd', 'u', 'p', 'e', 's', 'h', 'c'};
+static constexpr std::uint64_t cache_version = 2;
+
+
+HashCache::HashCache(std::string path) : path(std::move(path)) {}
+
+auto HashCache::set_probe_hash(HashKind kind) -> void {
+  probe_hash = kind;
+}
+
+auto HashCache::set_chunking(std::size_t threshold) -> void {
+  chunk_threshold = threshold;
+}
+
+// What `has_full` has to say for a full digest of this file to be any use
+auto HashCache::full_kind(const Task& task) const -> std::uint64_t {
+  return chunk_threshold > 0 and task.size >= chunk_threshold ? 2 : 1;
+}
+
+HashCache::~HashCache() {
+  if (mapping != nullptr) {
+    munmap(mapping, mapping_size);
+  }
+}
+
+// Map the cache from a previous run. A missing file is fine (first run). Anything malformed is ignored, and gets
+// overwritten by save().
+auto HashCache::open() -> bool {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return errno == ENOENT;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 or static_cast<std::size_t>(st.st_size) < sizeof(CacheHeader)) {
+    close(fd);
+    return false;
+  }
+
+  mapping_size = st.st_size;
+  mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    mapping = nullptr;
+    return false;
+  }
+
+  const auto* header = static_cast<const CacheHeader*>(mapping);
+  if (std::memcmp(header->magic, cache_magic, sizeof(cache_magic)) != 0 or header->version != cache_version or
+      mapping_size != sizeof(CacheHeader) + header->count * sizeof(CacheEntry)) {
+    munmap(mapping, mapping_size);
+    mapping = nullptr;
+    return false;
+  }
+
+  // Lookups binary search this, so let the kernel know we'll be jumping around
+  madvise(mapping, mapping_size, MADV_RANDOM);
+
+  entries = reinterpret_cast<const CacheEntry*>(static_cast<const char*>(mapping) + sizeof(CacheHeader));
+  count = header->count;
+  return true;
+}
+
+// Find the mapped entry for a file, if there is one and it's still current.
+auto HashCache::find(const Task& task) -> const CacheEntry* {
+  const CacheEntry* end = entries + count;
+  const CacheEntry* it = std::lower_bound(entries, end, task.key, [](const CacheEntry& entry, const FileKey& key) {
+    return std::tie(entry.dev, entry.ino) < std::tie(key.dev, key.ino);
+  });
+  if (it == end or it->dev != task.key.dev or it->ino != task.key.ino) {
+    return nullptr;
+  }
+  // Same inode, but the file changed since it was cached
+  if (it->size != task.size or it->mtime_ns != task.key.mtime_ns or it->ctime_ns != task.key.ctime_ns) {
+    return nullptr;
+  }
+  return it;
+}
+
+// Look up the digest a stage would produce. Only the mapped entries are searched, since nothing from this run can
+// answer a lookup for a stage that hasn't run yet.
+auto HashCache::lookup(const Task& task, Stage stage, std::size_t block, XXH128_hash_t& hash) -> bool {
+  const CacheEntry* entry = task.key.ino == 0 ? nullptr : find(task);
+  bool hit = false;
+  if (entry != nullptr) {
+    switch (stage) {
+      case Stage::head:
+        hit = entry->head_size == block and entry->probe_hash == static_cast<std::uint64_t>(probe_hash);
+        hash = entry->head;
+        break;
+      case Stage::tail:
+        hit = entry->tail_size == block and entry->probe_hash == static_cast<std::uint64_t>(probe_hash);
+        hash = entry->tail;
+        break;
+      case Stage::full:
+        hit = entry->has_full == full_kind(task);
+        hash = entry->full;
+        break;
+      // Samples depend on how many blocks were taken, and how big, so they are never kept
+      case Stage::sample:
+        break;
+    }
+  }
+  if (hit) {
+    hits++;
+  }
+  else {
+    misses++;
+  }
+  return hit;
+}
+
+// Remember a freshly computed digest. Called from the workers.
+auto HashCache::store(const Task& task, Stage stage, std::size_t block, XXH128_hash_t hash) -> void {
+  if (task.key.ino == 0) {
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(updates_mutex);
+  auto [it, inserted] = updates.try_emplace({task.key.dev, task.key.ino});
+  CacheEntry& entry = it->second;
+  if (inserted) {
+    // Keep whatever digests of the other stages are still valid
+    const CacheEntry* old = find(task);
+    if (old != nullptr) {
+      entry = *old;
+    }
+    else {
+      entry = {task.key.dev, task.key.ino, task.size, task.key.mtime_ns, task.key.ctime_ns, 0, 0, 0, 0, {}, {}, {}};
+    }
+  }
+
+  // Both probes have to be taken with the same hash, so a probe with a new one makes the other's stale
+  if ((stage == Stage::head or stage == Stage::tail) and entry.probe_hash != static_cast<std::uint64_t>(probe_hash)) {
+    entry.head_size = 0;
+    entry.tail_size = 0;
+    entry.probe_hash = static_cast<std::uint64_t>(probe_hash);
+  }
+
+  switch (stage) {
+    case Stage::head:
+      entry.head_size = block;
+      entry.head = hash;
+      break;
+    case Stage::tail:
+      entry.tail_size = block;
+      entry.tail = hash;
+      break;
+    case Stage::full:
+      entry.has_full = full_kind(task);
+      entry.full = hash;
+      break;
+    case Stage::sample:
+      break;
+  }
+}
+
+// Merge this run's digests into the old entries and write the result out. The file is written under a temporary
+// name and renamed over the old one, so a crash can never leave a half-written cache behind.
+auto HashCache::save() -> bool {
+  if (updates.empty()) {
+    return true;
+  }
+
+  std::string tmp = path + ".tmp";
+  std::FILE* fp = std::fopen(tmp.c_str(), "wb");
+  if (fp == nullptr) {
+    return false;
+  }
+
+  CacheHeader header = {};
+  std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+  header.version = cache_version;
+  std::fwrite(&header, sizeof(header), 1, fp);
+
+  // Both sides are sorted by (dev, ino), so this is a plain merge. Updated entries replace old ones.
+  std::size_t written = 0;
+  std::size_t ix = 0;
+  auto it = updates.begin();
+  while (ix < count or it != updates.end()) {
+    const CacheEntry* entry;
+    if (it == updates.end() or (ix < count and std::tie(entries[ix].dev, entries[ix].ino) < it->first)) {
+      entry = &entries[ix++];
+    }
+    else {
+      if (ix < count and std::tie(entries[ix].dev, entries[ix].ino) == it->first) {
+        ix++;
+      }
+      entry = &(it++)->second;
+    }
+    std::fwrite(entry, sizeof(CacheEntry), 1, fp);
+    written++;
+  }
+
+  header.count = written;
+  std::fseek(fp, 0, SEEK_SET);
+  std::fwrite(&header, sizeof(header), 1, fp);
+
+  bool ok = std::ferror(fp) == 0;
+  ok = std::fclose(fp) == 0 and ok;
+  if (!ok or std::rename(tmp.c_str(), path.c_str()) != 0) {
+    std::remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
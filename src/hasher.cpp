@@ -0,0 +1,84 @@
+#include "hasher.hpp"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+
+// Reflected Castagnoli polynomial
+static constexpr std::uint32_t castagnoli = 0x82f63b78;
+
+static auto make_table() -> std::array<std::uint32_t, 256> {
+  std::array<std::uint32_t, 256> table = {};
+  for (std::uint32_t byte = 0; byte < 256; ++byte) {
+    std::uint32_t crc = byte;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ (crc & 1 ? castagnoli : 0);
+    }
+    table[byte] = crc;
+  }
+  return table;
+}
+
+static auto crc32c_table(std::uint32_t crc, const unsigned char* data, std::size_t length) -> std::uint32_t {
+  static const std::array<std::uint32_t, 256> table = make_table();
+  for (std::size_t ix = 0; ix < length; ++ix) {
+    crc = table[(crc ^ data[ix]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+// Eight bytes per instruction. Compiled for SSE4.2 whatever the rest of the binary targets, and only ever called
+// once the CPU has said it has it.
+__attribute__((target("sse4.2")))
+static auto crc32c_sse42(std::uint32_t crc, const unsigned char* data, std::size_t length) -> std::uint32_t {
+  std::uint64_t wide = crc;
+  while (length >= 8) {
+    std::uint64_t word;
+    std::memcpy(&word, data, sizeof(word));
+    wide = _mm_crc32_u64(wide, word);
+    data += 8;
+    length -= 8;
+  }
+  crc = static_cast<std::uint32_t>(wide);
+  while (length > 0) {
+    crc = _mm_crc32_u8(crc, *data++);
+    length--;
+  }
+  return crc;
+}
+#endif
+
+using Crc32cFunction = std::uint32_t (*)(std::uint32_t, const unsigned char*, std::size_t);
+
+// Picked once, the first time anything gets hashed
+static auto pick_crc32c() -> Crc32cFunction {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("sse4.2")) {
+    return crc32c_sse42;
+  }
+#endif
+  return crc32c_table;
+}
+
+auto Crc32c::update(const void* data, std::size_t length) -> void {
+  static const Crc32cFunction function = pick_crc32c();
+  crc = function(crc, static_cast<const unsigned char*>(data), length);
+}
+
+
+auto hash_name(HashKind kind) -> const char* {
+  switch (kind) {
+    case HashKind::xxh3_64:
+      return "xxh3-64";
+    case HashKind::crc32c:
+      return "crc32c";
+    case HashKind::xxh3_128:
+      break;
+  }
+  return "xxh3-128";
+}
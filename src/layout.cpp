@@ -0,0 +1,55 @@
+#include "layout.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+
+
+auto locate(int fd, std::uint64_t ino) -> std::uint64_t {
+  std::uint64_t fallback = (std::uint64_t(1) << 63) | ino;
+
+  if (fd < 0) {
+    return fallback;
+  }
+
+  // Room for exactly one extent, which is all we need
+  alignas(fiemap) char storage[sizeof(fiemap) + sizeof(fiemap_extent)];
+  std::memset(storage, 0, sizeof(storage));
+  auto* map = reinterpret_cast<fiemap*>(storage);
+  map->fm_start = 0;
+  map->fm_length = FIEMAP_MAX_OFFSET;
+  map->fm_extent_count = 1;
+
+  int ret = ioctl(fd, FS_IOC_FIEMAP, map);
+
+  if (ret != 0 or map->fm_mapped_extents == 0) {
+    return fallback;
+  }
+  // Inline or not-yet-allocated data has no meaningful physical address
+  const fiemap_extent& extent = map->fm_extents[0];
+  if ((extent.fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_DELALLOC)) != 0) {
+    return fallback;
+  }
+  return extent.fe_physical & ~(std::uint64_t(1) << 63);
+}
+
+auto device_name(std::uint64_t dev) -> std::string {
+  return std::to_string(major(dev)) + ":" + std::to_string(minor(dev));
+}
+
+auto is_rotational(std::uint64_t dev) -> bool {
+  std::string base = "/sys/dev/block/" + device_name(dev);
+
+  // Partitions don't have a queue of their own, so fall back to the parent disk's
+  for (const auto& candidate : {base + "/queue/rotational", base + "/../queue/rotational"}) {
+    std::ifstream ifs(candidate);
+    int value;
+    if (ifs >> value) {
+      return value != 0;
+    }
+  }
+  return false;
+}
@@ -1,16 +1,35 @@
 #include "parsing.hpp"
+#include "cache.hpp"
+#include "layout.hpp"
 #include "logging.hpp"
+#include "manifest.hpp"
+#include "metrics.hpp"
+#include "output.hpp"
 #include "progressbar.hpp"
+#include "replace.hpp"
 #include "threadpool.hpp"
+#include "uring.hpp"
 #include "utils.hpp"
+#include "verify.hpp"
+#include "walker.hpp"
+
+#include <cstring>
+#include <fcntl.h>
+#include <set>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
 
 
 auto create_parser() -> parsing::ArgumentParser;
 
 auto main(int argc, char** argv) -> int {
 
-  // Save cursor position (allows cleanup function to be indiscriminate)
-  std::cout << "\x1b[s";
+  // Save cursor position (allows cleanup function to be indiscriminate). Not when piped, where it'd just be noise
+  // in front of the output.
+  if (isatty(STDOUT_FILENO)) {
+    std::cout << "\x1b[s";
+  }
 
   // Set handler for signal as early as possible.
   std::signal(SIGTERM, restore_terminal);
@@ -18,11 +37,9 @@ auto main(int argc, char** argv) -> int {
 
   namespace fs = std::filesystem;
 
-  TimeStats stats;
-
-  // Start timer
-  std::size_t t0 = now();
-  stats.proc_start = t0;
+  // Every phase of the run gets timed and counted in here. --timed, --debug and --stats-json all report from it.
+  Metrics metrics;
+  metrics.begin("parse");
 
   // It was getting hard to read with this monstrosity in the way.
   auto parser = create_parser();
@@ -30,8 +47,7 @@ auto main(int argc, char** argv) -> int {
 
   auto options = parser.parse_args(argc - 1, argv + 1);
 
-  // Log time for parsing
-  stats.parsing = now() - t0;
+  metrics.end();
 
   // Convenience
   auto quiet = options["quiet"].as_bool();
@@ -43,8 +59,77 @@ auto main(int argc, char** argv) -> int {
 
   // Get a better argument parser.
   // Remove this after typing is added to the Arguments
-  if (!is_number(options["threads"].as_string())) {
-    logger.error("threads must be a positive integer");
+  bool auto_threads = options["threads"].as_string() == "auto";
+  if (!auto_threads and !is_number(options["threads"].as_string())) {
+    logger.error("threads must be a positive integer or 'auto'");
+    return 1;
+  }
+  // With auto, the hashing pool finds its own count as it goes. Everything else just gets one thread per core.
+  std::size_t threads = auto_threads ? std::max<std::size_t>(std::thread::hardware_concurrency(), 1) : options["threads"].as_size_t();
+
+  for (const auto& name : {"walk-threads", "device-threads", "head-size", "tail-size", "queue-depth", "mmap-threshold", "max-open", "batch-size", "sample-blocks", "sample-size", "sample-threshold", "chunk-threshold"}) {
+    if (!is_number(options[name].as_string())) {
+      logger.error(std::string(name) + " must be a positive integer");
+      return 1;
+    }
+  }
+
+  IoEngine io_engine = IoEngine::sync;
+
+  if (options["io-engine"].as_string() == "uring") {
+    io_engine = IoEngine::uring;
+    if (!Ring::supported()) {
+      logger.warn("io_uring is unavailable, falling back to '--io-engine sync'");
+      io_engine = IoEngine::sync;
+    }
+  }
+  else if (options["io-engine"].as_string() != "sync") {
+    logger.error("invalid value for '--io-engine': " + repr(options["io-engine"].as_string()));
+    return 1;
+  }
+
+  HashKind probe_hash = HashKind::xxh3_64;
+
+  if (options["probe-hash"].as_string() == "xxh3-128") {
+    probe_hash = HashKind::xxh3_128;
+  }
+  else if (options["probe-hash"].as_string() == "crc32c") {
+    probe_hash = HashKind::crc32c;
+  }
+  else if (options["probe-hash"].as_string() != "xxh3-64") {
+    logger.error("invalid value for '--probe-hash': " + repr(options["probe-hash"].as_string()));
+    return 1;
+  }
+
+  WalkEngine walk_engine = WalkEngine::getdents;
+
+  if (options["walk-engine"].as_string() == "filesystem") {
+    walk_engine = WalkEngine::filesystem;
+  }
+  else if (options["walk-engine"].as_string() != "getdents") {
+    logger.error("invalid value for '--walk-engine': " + repr(options["walk-engine"].as_string()));
+    return 1;
+  }
+
+  OutputFormat output_format = OutputFormat::text;
+
+  if (options["format"].as_string() == "jsonl") {
+    output_format = OutputFormat::jsonl;
+  }
+  else if (options["format"].as_string() == "csv") {
+    output_format = OutputFormat::csv;
+  }
+  else if (options["format"].as_string() == "binary") {
+    output_format = OutputFormat::binary;
+  }
+  else if (options["format"].as_string() != "text") {
+    logger.error("invalid value for '--format': " + repr(options["format"].as_string()));
+    return 1;
+  }
+
+  const std::string layout_order = options["layout-order"].as_string();
+  if (layout_order != "auto" and layout_order != "on" and layout_order != "off") {
+    logger.error("invalid value for '--layout-order': " + repr(layout_order));
     return 1;
   }
 
@@ -54,8 +139,65 @@ auto main(int argc, char** argv) -> int {
     return 1;
   }
 
-  // Reset timer
-  t0 = now();
+  const std::string stats_json = options["stats-json"].as_string();
+  if (!stats_json.empty()) {
+    metrics.report_to(stats_json);
+  }
+
+  // Nothing gets scanned: the sources are manifests from earlier scans, and only what they have in common is reported
+  if (options["merge"].as_bool()) {
+    if (output_format != OutputFormat::text) {
+      logger.error("'--merge' only writes text");
+      return 1;
+    }
+    std::vector<manifest::Reader> readers;
+    for (const auto& file : options["sources"].as_strings()) {
+      readers.emplace_back(file);
+      if (!readers.back().open()) {
+        logger.error("can't read manifest " + repr(file) + ": " + readers.back().error);
+        return 1;
+      }
+    }
+
+    metrics.begin("merge");
+    std::size_t total_wasted = 0;
+    OutputBuffer out(STDOUT_FILENO);
+    std::string error;
+    bool any = false;
+    bool complete = manifest::merge(readers, [&](std::size_t ix, const manifest::Entry& entry, bool first) {
+      if (!first) {
+        total_wasted += entry.size;
+      }
+      if (quiet or silent) {
+        return;
+      }
+      if (first and any) {
+        out.put(options["separator"].as_char());
+      }
+      any = true;
+      out.append(readers.at(ix).host + ':' + readers.at(ix).path(entry));
+      out.put(options["separator"].as_char());
+    }, error);
+    if (any) {
+      out.put(options["separator"].as_char());
+    }
+    out.flush();
+    metrics.end();
+
+    if (!complete) {
+      logger.error(error);
+    }
+    if (options["wasted-space"].as_bool() and !silent) {
+      std::cout << "Wasted space from duplicate files: " << fsize(total_wasted, options["binary"].as_bool()) << '\n';
+    }
+    if (options["timed"].as_bool() and !silent) {
+      std::cout << "Elapsed time: " << ftime_ns(metrics.elapsed()) << "\n";
+    }
+    if (!metrics.write()) {
+      logger.warn("failed to write metrics: " + repr(stats_json));
+    }
+    return complete ? 0 : 1;
+  }
 
   std::vector<std::string> sources = options["sources"].as_strings();
 
@@ -76,8 +218,93 @@ auto main(int argc, char** argv) -> int {
     continue;
   }
 
-  fs::path source;
-  std::map<std::size_t,std::vector<std::string>> sizes;
+  std::unique_ptr<HashCache> cache;
+
+  if (!options["cache"].as_string().empty()) {
+    cache = std::make_unique<HashCache>(options["cache"].as_string());
+    if (!cache->open()) {
+      logger.warn("ignoring unreadable hash cache: " + repr(options["cache"].as_string()));
+    }
+    cache->set_probe_hash(probe_hash);
+    cache->set_chunking(options["chunk-threshold"].as_size_t());
+  }
+
+  // Checked before anything gets hashed, since duplicates are acted on as soon as each batch is done
+  std::string dryrun_action;
+
+  ReplaceMode replace_mode = ReplaceMode::hardlink;
+
+  if (options["replace"].as_string() == "symlink") {
+    replace_mode = ReplaceMode::symlink;
+    dryrun_action = "Symlinking";
+  }
+  else if (options["replace"].as_string() == "hardlink") {
+    replace_mode = ReplaceMode::hardlink;
+    dryrun_action = "Hardlinking";
+  }
+  else if (options["replace"].as_string() == "reflink") {
+    replace_mode = ReplaceMode::reflink;
+    dryrun_action = "Reflinking";
+  }
+  else if (options["replace"].as_string() != "none") {
+    logger.error("invalid value for '--replace': " + repr(options["replace"].as_string()));
+    return -1;
+  }
+
+  bool verify = options["verify"].as_bool();
+
+  // Sampled groups are only probable duplicates, so nothing gets replaced on the strength of them
+  std::size_t sample_blocks = options["sample-blocks"].as_size_t();
+  bool confirm = options["confirm"].as_bool();
+  if (sample_blocks > 0 and !confirm and !verify and options["replace"].as_string() != "none") {
+    logger.error("'--sample-blocks' only finds probable duplicates, so '--replace' needs '--confirm' (or '--verify') with it");
+    return 1;
+  }
+
+  // Every file goes into the manifest with a digest of all of it, since its duplicates may well be on another host.
+  // So nothing can be ruled out for being the only one of its size here, and nothing is settled short of a full hash.
+  std::unique_ptr<manifest::Writer> manifest_out;
+  if (!options["manifest-out"].as_string().empty()) {
+    if (sample_blocks > 0 and !confirm) {
+      logger.error("'--manifest-out' needs full digests, so '--sample-blocks' needs '--confirm' with it");
+      return 1;
+    }
+    manifest_out = std::make_unique<manifest::Writer>(options["manifest-out"].as_string(), options["chunk-threshold"].as_size_t());
+  }
+  bool everything = manifest_out != nullptr;
+
+  // (stage, block size, name, progress bar prefix). A probe with a block size of 0 is skipped, and so is sampling.
+  const std::vector<std::tuple<Stage, std::size_t, std::string, std::string>> stages = {
+    {Stage::head, options["head-size"].as_size_t(), "head", "Probing heads:  "},
+    {Stage::tail, options["tail-size"].as_size_t(), "tail", "Probing tails:  "},
+    {Stage::sample, sample_blocks > 0 ? options["sample-size"].as_size_t() : 0, "sample", "Sampling files: "},
+    {Stage::full, 0, "full", "Hashing files:  "},
+  };
+
+  // Whether a stage reads anything. --verify compares every byte itself, so a sample or a full hash first would just
+  // be more reading.
+  auto runs = [verify, everything](Stage stage, std::size_t block) {
+    if (stage == Stage::full or stage == Stage::sample) {
+      return (!verify or everything) and (stage == Stage::full or block > 0);
+    }
+    return block > 0;
+  };
+
+  // The first stage that actually hashes anything. That's the one --pipeline runs during the walk.
+  std::size_t first_stage = 0;
+  while (first_stage < stages.size() and !runs(std::get<0>(stages.at(first_stage)), std::get<1>(stages.at(first_stage)))) {
+    first_stage++;
+  }
+
+  bool pipelined = options["pipeline"].as_bool();
+  if (pipelined and first_stage == stages.size()) {
+    logger.debug("nothing gets hashed before --verify, so there is nothing to pipeline");
+    pipelined = false;
+  }
+  if (pipelined and everything) {
+    logger.debug("--manifest-out needs every file, not just the ones with a match here, so there is nothing to pipeline");
+    pipelined = false;
+  }
 
   std::size_t total_walked = 0;
   std::size_t total_hashed = 0;
@@ -85,205 +312,653 @@ auto main(int argc, char** argv) -> int {
   // Hide cursor
   if (progress) {
     std::cout << "\x1b[?25l";
+    ProgressBar::watch_terminal();
+  }
+
+  // Draws whatever is going on from its own thread, so that nothing doing the work has to wait for the terminal
+  ProgressReporter reporter(options["binary"].as_bool());
+
+  // 0 means "however many --threads says"
+  std::size_t walk_threads = options["walk-threads"].as_size_t();
+  if (walk_threads == 0) {
+    walk_threads = threads;
   }
 
-  while (!stack.empty()) {
-    source = stack.front();
-    stack.pop_front();
+  Walker walker(walk_threads, options["recursive"].as_bool(), walk_engine);
+  walker.set_streaming(pipelined);
+
+  // Paths get looked up in here, for as long as there are tasks around
+  const PathTable& paths = walker.paths;
+
+  metrics.begin("walk", walker.counters(), [&walker] { return walker.depth(); });
+
+  walker.start(stack);
 
+  // Sorted by size, so every run of equal sizes is one bucket of candidates. Only filled in without --pipeline.
+  std::vector<Task>& found = walker.files;
+
+  // Each bucket as [begin, end) in `found`, leaving out the ones that can't have a duplicate
+  std::vector<std::pair<std::size_t, std::size_t>> buckets;
+
+  // Devices that files to hash may be on
+  std::set<std::uint64_t> devices;
+
+  if (!pipelined) {
     if (progress) {
-      std::cout << "Files Walked: " << total_walked << "\x1b[u";
+      reporter.show([&walker] { return "Files Walked: " + std::to_string(walker.walked()); });
     }
 
-    if (!fs::exists(source)) {
-      logger.warn("invalid directory: " + repr(source));
-      continue;
-    }
+    walker.join();
+    reporter.hide();
 
-    if (file_is_unreadable(source)) {
-      logger.warn("permission denied: " + repr(source.native()));
-      continue;
-    }
+    total_walked = walker.walked();
 
-    for (const auto& dir : fs::directory_iterator(source)) {
-      if (dir.is_symlink()) {
-        continue;
+    for (std::size_t begin = 0, end = 0; begin < found.size(); begin = end) {
+      end = begin + 1;
+      while (end < found.size() and found.at(end).size == found.at(begin).size) {
+        end++;
       }
-      if (dir.is_directory()) {
-        if (options["recursive"].as_bool()) {
-          stack.emplace_back(dir.path());
-        }
+      if ((end - begin < 2 and !everything) or (found.at(begin).size == 0 and options["skip-empty"].as_bool())) {
         continue;
       }
-      if (dir.is_regular_file()) {
-        total_walked++;
-        sizes[dir.file_size()].emplace_back(dir.path());
-        continue;
+      buckets.emplace_back(begin, end);
+      for (std::size_t ix = begin; ix < end; ++ix) {
+        devices.insert(found.at(ix).key.dev);
+      }
+    }
+
+    metrics.note("hardlinks_collapsed", walker.collapsed);
+    metrics.end();
+  }
+  else {
+    // Candidates aren't known yet, so go by where the walk starts. Anything mounted below a source shares the
+    // catch-all queue.
+    for (const auto& root : stack) {
+      struct stat st;
+      if (stat(root.c_str(), &st) == 0) {
+        devices.insert(st.st_dev);
       }
     }
   }
 
-  // For some reason, if I do this inside the [size,files] loops, I get string error
-  if (options["skip-empty"].as_bool()) {
-    sizes[0].clear();
+  // Every device gets its own queue and its own limit on concurrent reads, so one slow disk can't hold up the rest.
+  // Spinning disks pay for every seek, so by default they get one reader each, and their files are read in the order
+  // the data sits on disk. Anything else has no limit beyond --threads.
+  std::size_t device_threads = options["device-threads"].as_size_t();
+  bool ordered = layout_order == "on";
+
+  std::vector<std::pair<std::uint64_t, std::size_t>> device_limits;
+  std::size_t spindles = 0;
+  for (std::uint64_t dev : devices) {
+    bool rotational = is_rotational(dev);
+    spindles += rotational;
+    std::size_t limit = device_threads > 0 ? device_threads : (rotational ? 1 : 0);
+    device_limits.emplace_back(dev, limit);
+    logger.debug("device " + device_name(dev) + (rotational ? " (rotational)" : "") + ": " + (limit == 0 ? "no limit on reads" : "at most " + std::to_string(limit) + " file(s) read at once"));
   }
 
-  // Log time for filesystem traversal
-  stats.filesystem = now() - t0;
+  if (layout_order == "auto" and !devices.empty() and spindles == devices.size()) {
+    ordered = true;
+    logger.debug("rotational storage: reading in on-disk order");
+  }
 
+  ThreadPool tp(threads);
+  tp.set_autotune(auto_threads);
 
-  for (const auto& [size, files] : sizes) {
-    if (files.size() < 2) {
-      continue;
+  tp.set_devices(device_limits);
+
+  tp.set_paths(&paths);
+  tp.set_cache(cache.get());
+  tp.set_io(io_engine, options["queue-depth"].as_size_t());
+  tp.set_mmap_threshold(options["mmap-threshold"].as_size_t());
+  tp.set_sampling(sample_blocks, options["sample-threshold"].as_size_t());
+  tp.set_probe_hash(probe_hash);
+  tp.set_chunking(options["chunk-threshold"].as_size_t());
+  tp.set_locating(ordered);
+  logger.debug(std::string("probing with ") + hash_name(probe_hash));
+  tp.start();
+
+  Verifier verifier(threads, options["max-open"].as_size_t(), paths);
+  Replacer replacer(threads, replace_mode, paths);
+
+  // Groups that survived sampling, without --confirm. They get output separately, marked as such.
+  std::vector<std::vector<Task>> probable;
+  std::size_t total_probable = 0;
+
+  // For groups whose digests don't cover every byte, which the output then leaves out
+  auto forget_digests = [](std::vector<Task>& files) {
+    for (auto& file : files) {
+      file.digest = {0, 0};
     }
-    total_hashed += files.size();
-  }
+  };
 
-  // Reset timer
-  t0 = now();
+  // Run one batch of candidate groups through every stage, and return the groups that turned out to be duplicates.
+  // `queued` is how many tasks are already in the pool for the first stage (see --pipeline), on top of `groups`.
+  auto settle = [&](std::vector<std::vector<Task>> groups, std::size_t queued) -> std::vector<std::vector<Task>> {
+    // Groups that have had every byte compared, and so need no further stages
+    std::vector<std::vector<Task>> duplicates;
 
-  ThreadPool tp(options["threads"].as_size_t());
+    // How many bytes at the start and end of each file the probes have compared so far
+    std::size_t covered = 0;
 
-  ProgressBar pbar(total_hashed);
+    for (const auto& [stage, block, name, label] : stages) {
+      if (groups.empty() and queued == 0) {
+        break;
+      }
+      if (!runs(stage, block)) {
+        continue;
+      }
 
-  tp.start();
+      std::size_t stage_total = queued;
+      for (const auto& files : groups) {
+        stage_total += files.size();
+      }
 
-  if (progress) {
-    pbar.set_prefix("Queueing tasks: ");
-  }
+      // The pool is already busy with whatever was queued, and can only switch stages while idle
+      if (queued == 0) {
+        tp.set_stage(stage, block);
+      }
+      queued = 0;
+
+      metrics.begin(name, tp.counters(), [&tp] { return tp.depth(); });
+      std::size_t cache_hits = cache ? cache->hits : 0;
+      std::size_t cache_misses = cache ? cache->misses : 0;
+
+      // Bytes the stage has yet to read, as far as queued so far. Files from the cache don't count.
+      std::atomic<std::uint64_t> stage_bytes = 0;
+      std::uint64_t bytes_before = tp.bytes_read();
 
-  for (const auto& [size, files] : sizes) {
-    if (files.size() < 2) {
-      continue;
-    }
-    for (const auto& item : files) {
-      tp.enqueue(item);
       if (progress) {
-        pbar.update(1);
-        std::cout << pbar.bar << "\x1b[u";
+        reporter.show(label, [&tp, &stage_bytes, stage_total, bytes_before] {
+          return ProgressReporter::Sample{tp.completed(), stage_total, tp.bytes_read() - bytes_before, stage_bytes.load(std::memory_order_relaxed)};
+        });
       }
-    }
-  }
 
-  if (progress) {
-    pbar.reset();
-    pbar.set_prefix("Hashing files:  ");
-  }
+      XXH128_hash_t cached;
 
-  if (progress) {
-    std::size_t td;
-    while (tp.busy()) {
-      {
-        std::unique_lock<std::mutex> lock(tp.total_mutex);
-        td = tp.total_done;
-      }
-      pbar.set_progress(tp.total_done);
-      std::cout << pbar.bar << "\x1b[u";
-      if (td == total_hashed) {
-        break;
+      // Groups are otherwise queued in size order, which has nothing to do with where the files are on disk
+      std::vector<Task*> order;
+      order.reserve(stage_total);
+      for (std::size_t gix = 0; gix < groups.size(); ++gix) {
+        for (auto& task : groups.at(gix)) {
+          task.group = gix;
+          order.push_back(&task);
+        }
+      }
+      // Where a file's data is only gets known once a worker has had it open. Until then a file sorts by its inode,
+      // after every file whose extent is known, so the first stage goes in inode order and the rest in on-disk order.
+      if (ordered) {
+        auto where = [](const Task* task) { return task->location != 0 ? task->location : locate(-1, task->key.ino); };
+        std::sort(order.begin(), order.end(), [&where](const Task* left, const Task* right) {
+          return std::make_pair(left->key.dev, where(left)) < std::make_pair(right->key.dev, where(right));
+        });
+      }
+
+      for (Task* task : order) {
+        Stage as = tp.stage_of(*task);
+        if (cache and as != Stage::sample and cache->lookup(*task, as, block, cached)) {
+          tp.record(std::move(*task), cached);
+        }
+        else {
+          stage_bytes.fetch_add(tp.reads(*task), std::memory_order_relaxed);
+          tp.enqueue(std::move(*task));
+        }
+      }
+
+      tp.join();
+      reporter.hide();
+
+      // 32 bits can rule files out, but a match isn't strong enough to skip the full stage on
+      if ((stage == Stage::head or stage == Stage::tail) and probe_hash != HashKind::crc32c) {
+        covered += block;
+      }
+
+      // Regroup by (previous group, hash). Anything left on its own is unique, so it gets dropped here.
+      std::vector<std::vector<Task>> survivors;
+      std::size_t stage_survivors = 0;
+      std::size_t stage_settled = 0;
+      std::size_t stage_probable = 0;
+
+      for (std::size_t key = 0; key < tp.results.size(); ++key) {
+        auto indices = tp.results.members(key);
+        if (indices.size() < 2 and !everything) {
+          continue;
+        }
+        std::vector<Task> files;
+        files.reserve(indices.size());
+        for (auto ix : indices) {
+          files.emplace_back(std::move(tp.task(ix)));
+          files.back().digest = tp.results.digest(key);
+          if (stage == Stage::head or stage == Stage::tail) {
+            files.back().probes.at(stage == Stage::head ? 0 : 1) = files.back().digest.low64;
+          }
+        }
+        std::size_t size = files.at(0).size;
+        stage_survivors += files.size();
+        // Files too small to sample or probe got hashed whole, so they're as settled as after the full stage
+        if (tp.stage_of(files.at(0)) == Stage::full or (size <= covered and !everything)) {
+          // Only a whole-file hash leaves a digest of every byte
+          if (tp.stage_of(files.at(0)) != Stage::full) {
+            forget_digests(files);
+          }
+          if (manifest_out) {
+            for (const auto& file : files) {
+              manifest_out->add(file);
+            }
+          }
+          stage_settled += files.size();
+          duplicates.emplace_back(std::move(files));
+          continue;
+        }
+        if (stage == Stage::sample and !confirm) {
+          stage_probable += files.size();
+          total_probable += 1;
+          forget_digests(files);
+          probable.emplace_back(std::move(files));
+          continue;
+        }
+        survivors.emplace_back(std::move(files));
+      }
+
+      tp.reset();
+      groups = std::move(survivors);
+
+      // For the probes, the elimination rate is how well they work as a prefilter
+      metrics.note("candidates", stage_total);
+      metrics.note("eliminated", stage_total - stage_survivors);
+      metrics.note("settled", stage_settled);
+      if (stage == Stage::sample) {
+        metrics.note("probable", stage_probable);
+      }
+      if (cache) {
+        metrics.note("cache_hits", cache->hits - cache_hits);
+        metrics.note("cache_misses", cache->misses - cache_misses);
+      }
+      if (auto_threads) {
+        metrics.set("threads", tp.tuned());
       }
-      std::this_thread::sleep_for(std::chrono::microseconds(10));
+      metrics.end();
     }
-    pbar.set_progress(total_hashed);
-    std::cout << pbar.bar << "\x1b[2K\x1b[u\x1b[2K\x1b[?25h";
-    std::cout.flush();
-  }
 
-  tp.join();
-  tp.stop();
+    if (verify) {
+      // Groups settled by the probes only had their digests compared, so they get checked too. They're small anyway.
+      std::size_t verify_total = 0;
+      for (auto& files : groups) {
+        forget_digests(files);
+      }
+      for (auto& files : duplicates) {
+        groups.emplace_back(std::move(files));
+      }
+      for (const auto& files : groups) {
+        verify_total += files.size();
+      }
+
+      metrics.begin("verify", verifier.counters());
+      duplicates = verifier.verify(std::move(groups));
+
+      std::size_t verify_survivors = 0;
+      for (const auto& files : duplicates) {
+        verify_survivors += files.size();
+      }
+      metrics.note("candidates", verify_total);
+      metrics.note("eliminated", verify_total - verify_survivors);
+      metrics.end();
+    }
 
-  // Log time for hashing
-  stats.hashing = now() - t0;
+    return duplicates;
+  };
 
   std::size_t total_wasted = 0;
 
-  std::string dryrun_action;
+  // Everything duplicates-related goes to stdout through here, in big writes
+  OutputBuffer out(STDOUT_FILENO);
+  ResultWriter writer(output_format, options["separator"].as_char(), paths, out);
+  // Filesystems already warned about not doing reflinks
+  std::set<std::uint64_t> unsupported;
 
-  fs::copy_options copy_options;
+  // Print (or act on) one batch's duplicates. Flushed right away, so whatever reads the output can get going.
+  auto emit = [&](const std::vector<std::vector<Task>>& duplicates, bool sampled) {
+    if (duplicates.empty()) {
+      return;
+    }
+    metrics.begin("output");
 
-  if (options["replace"].as_string() == "symlink") {
-    copy_options = fs::copy_options::create_symlinks;
-    dryrun_action = "Symlinking";
-  }
-  else if (options["replace"].as_string() == "hardlink") {
-    copy_options = fs::copy_options::create_hard_links;
-    dryrun_action = "Hardlinking";
-  }
-  else if (options["replace"].as_string() != "none") {
-    logger.error("invalid value for '--replace': " + repr(options["replace"].as_string()));
-    return -1;
-  }
+    // Every member of a group is a distinct inode (hardlinks were collapsed by the walker), so nothing here needs to
+    // touch the filesystem again just to tell them apart.
+    if (options["replace"].as_string() == "none") {
+      for (const auto& files : duplicates) {
+        if (files.size() < 2) {
+          continue;
+        }
+        total_wasted += files.at(0).size * (files.size() - 1);
 
-  std::vector<std::string> nonlinks;
+        if (!quiet and !silent) {
+          writer.group(files, sampled);
+        }
+      }
+      out.flush();
+      metrics.end();
+      return;
+    }
 
-  for (const auto& [high, inner] : tp.results) {
-    for (const auto& [low, files] : inner) {
+    // Every group's jobs back to back, and where each group's start
+    std::vector<Replacement> jobs;
+    std::vector<std::size_t> starts;
+    for (const auto& files : duplicates) {
       if (files.size() < 2) {
         continue;
       }
-
-      nonlinks = {files.at(0)};
-
+      starts.push_back(jobs.size());
+      std::string kept = paths.path(files.at(0).path);
       for (std::size_t ix = 1; ix < files.size(); ++ix) {
-        if (fs::equivalent(files.at(0), files.at(ix))) {
-          continue;
+        jobs.push_back({kept, files.at(ix).path, files.at(ix).key.dev, files.at(ix).size});
+        // Every link to a duplicate inode has to go, or the space never gets freed. A reflink shares the inode's data,
+        // which all of its links already see.
+        if (replace_mode != ReplaceMode::reflink) {
+          for (const auto& ref : files.at(ix).links) {
+            jobs.push_back({kept, ref, files.at(ix).key.dev, files.at(ix).size});
+          }
         }
-        nonlinks.push_back(files.at(ix));
       }
+    }
 
-      if (nonlinks.size() < 2) {
-        continue;
+    if (not options["dryrun"].as_bool()) {
+      std::atomic<std::size_t> replaced = 0;
+      if (progress) {
+        std::size_t total = jobs.size();
+        reporter.show("Replacing:      ", [&replaced, total] {
+          return ProgressReporter::Sample{replaced.load(std::memory_order_relaxed), total, 0, 0};
+        });
       }
+      replacer.run(jobs, [&](std::size_t done) {
+        replaced.store(done, std::memory_order_relaxed);
+      });
+      reporter.hide();
+    }
 
-      if (options["replace"].as_string() == "none") {
-        total_wasted += fs::file_size(nonlinks.at(0)) * (nonlinks.size() - 1);
+    // Same lines, in the same order, as --dryrun said there would be. Whatever didn't work out gets a warning instead.
+    for (std::size_t six = 0; six < starts.size(); ++six) {
+      std::size_t first = starts.at(six);
+      std::size_t last = six + 1 < starts.size() ? starts.at(six + 1) : jobs.size();
 
-        if (!quiet and !silent) {
-          for (const auto& item : nonlinks) {
-            std::cout << item << options["separator"].as_char();
+      if (options["dryrun"].as_bool() or (!quiet and !silent)) {
+        out.append("Keeping: " + repr(jobs.at(first).kept) + '\n');
+      }
+      for (std::size_t ix = first; ix < last; ++ix) {
+        const Replacement& job = jobs.at(ix);
+        std::string item = paths.path(job.target);
+        switch (job.outcome) {
+        case Replacement::Outcome::pending:
+        case Replacement::Outcome::done:
+          if (options["dryrun"].as_bool() or (!quiet and !silent)) {
+            out.append(dryrun_action + ": " + repr(item) + '\n');
+          }
+          break;
+        case Replacement::Outcome::failed:
+          logger.warn("could not replace " + repr(item) + ": " + std::strerror(job.error));
+          break;
+        case Replacement::Outcome::differs:
+          logger.warn("not reflinking " + repr(item) + ": it no longer matches " + repr(job.kept));
+          break;
+        case Replacement::Outcome::unsupported:
+          // Once per filesystem is plenty
+          if (unsupported.insert(job.dev).second) {
+            logger.warn("reflinks are not supported on the filesystem of " + repr(item) + ": " + std::strerror(job.error));
           }
-          std::cout << options["separator"].as_char();
+          break;
         }
-        continue;
       }
+      if (options["dryrun"].as_bool() or (!quiet and !silent)) {
+        out.put('\n');
+      }
+    }
+
+    out.flush();
+    metrics.end();
+  };
+
+  // Candidates go through in batches of whole size buckets, smallest first, and each batch's duplicates are output
+  // as soon as it's done. Results start showing up long before a big scan is over, and only
+  // one batch's worth of tasks is ever held by the pool. A batch size of 0 does everything in one go.
+  std::size_t batch_size = options["batch-size"].as_size_t();
+  std::vector<std::vector<Task>> batch;
+  std::size_t batch_files = 0;
+
+  for (const auto& [begin, end] : buckets) {
+    batch_files += end - begin;
+    total_hashed += end - begin;
+    batch.emplace_back(std::make_move_iterator(found.begin() + begin), std::make_move_iterator(found.begin() + end));
+    if (batch_size > 0 and batch_files >= batch_size) {
+      emit(settle(std::move(batch), 0), false);
+      emit(std::exchange(probable, {}), true);
+      batch.clear();
+      batch_files = 0;
+    }
+  }
+  if (!batch.empty()) {
+    emit(settle(std::move(batch), 0), false);
+    emit(std::exchange(probable, {}), true);
+  }
 
-      if (options["dryrun"].as_bool()) {
-        std::cout << "Keeping: " << repr(nonlinks.at(0)) << '\n';
+  if (pipelined) {
+    // Hash while walking. A size bucket's first file is held back until a second one turns up, then both go to the
+    // pool, and every later file of that size goes straight in. Each inode is only ever queued once: further paths to
+    // it are hung off its task as links. The rest of the stages run once the walk is over, as one batch.
+    struct Bucket {
+      Task first;
+      std::size_t group = 0;
+      bool dispatched = false;
+    };
+    std::unordered_map<std::size_t, Bucket> sizes;
+
+    // (dev, ino) -> index in the pool's table, or npos while it's some bucket's first file
+    auto inode_hash = [](const std::pair<std::uint64_t, std::uint64_t>& id) {
+      return std::hash<std::uint64_t>()(id.first * 0x9E3779B97F4A7C15ULL ^ id.second);
+    };
+    std::unordered_map<std::pair<std::uint64_t, std::uint64_t>, std::size_t, decltype(inode_hash)> inodes(0, inode_hash);
+    constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+    const auto& [stage, block, name, label] = stages.at(first_stage);
+    tp.set_stage(stage, block);
+
+    // The pool's counters go into the walk phase for as long as the two overlap
+    std::vector<const ThreadCounters*> sources = walker.counters();
+    for (const auto* counters : tp.counters()) {
+      sources.push_back(counters);
+    }
+    metrics.begin("walk", sources, [&walker, &tp] { return walker.depth() + tp.depth(); });
+    std::size_t cache_hits = cache ? cache->hits : 0;
+    std::size_t cache_misses = cache ? cache->misses : 0;
+
+    std::size_t queued = 0;
+    std::size_t next_group = 0;
+    std::size_t collapsed = 0;
+    XXH128_hash_t cached;
+    // A copy of `queued` for the reporter's thread to read
+    std::atomic<std::size_t> shown_queued = 0;
+
+    auto submit = [&](Task task, std::size_t group) -> std::size_t {
+      task.group = group;
+      queued++;
+      shown_queued.store(queued, std::memory_order_relaxed);
+      Stage as = tp.stage_of(task);
+      if (cache and as != Stage::sample and cache->lookup(task, as, block, cached)) {
+        return tp.record(std::move(task), cached);
       }
+      return tp.enqueue(std::move(task));
+    };
 
-      for (std::size_t ix = 1; ix < nonlinks.size(); ++ix) {
-        if (not options["dryrun"].as_bool()) {
-          fs::remove(nonlinks.at(ix));
-          fs::copy(nonlinks.at(0), nonlinks.at(ix), copy_options);
-          continue;
+    auto dispatch = [&](Task task) {
+      if (task.size == 0 and options["skip-empty"].as_bool()) {
+        return;
+      }
+      std::pair<std::uint64_t, std::uint64_t> id = {task.key.dev, task.key.ino};
+      auto known = inodes.find(id);
+      if (known != inodes.end()) {
+        auto& links = known->second == npos ? sizes.at(task.size).first.links : tp.task(known->second).links;
+        links.push_back(task.path);
+        collapsed++;
+        return;
+      }
+      auto [it, inserted] = sizes.try_emplace(task.size);
+      Bucket& bucket = it->second;
+      if (inserted) {
+        bucket.first = std::move(task);
+        inodes.emplace(id, npos);
+        return;
+      }
+      if (!bucket.dispatched) {
+        bucket.group = next_group++;
+        bucket.dispatched = true;
+        inodes[{bucket.first.key.dev, bucket.first.key.ino}] = submit(std::move(bucket.first), bucket.group);
+      }
+      inodes.emplace(id, submit(std::move(task), bucket.group));
+    };
+
+    std::vector<Task> taken;
+    auto drain = [&] {
+      taken.clear();
+      if (walker.take(taken)) {
+        for (auto& task : taken) {
+          dispatch(std::move(task));
         }
-        std::cout << dryrun_action << ": " << repr(nonlinks.at(ix)) << '\n';
       }
+    };
+
+    if (progress) {
+      reporter.show([&walker, &tp, &shown_queued] {
+        return "Files Walked: " + std::to_string(walker.walked()) + ", Hashed: " + std::to_string(tp.completed()) + " of " + std::to_string(shown_queued.load(std::memory_order_relaxed));
+      });
+    }
 
-      if (options["dryrun"].as_bool()) {
-        std::cout << '\n';
+    while (walker.busy()) {
+      drain();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    walker.join();
+    drain();
+    reporter.hide();
+
+    total_walked = walker.walked();
+    total_hashed = queued;
+    walker.collapsed = collapsed;
+
+    metrics.note("hardlinks_collapsed", collapsed);
+    if (cache) {
+      metrics.note("cache_hits", cache->hits - cache_hits);
+      metrics.note("cache_misses", cache->misses - cache_misses);
+    }
+    sizes.clear();
+    inodes.clear();
+
+    std::vector<std::vector<Task>> duplicates = settle({}, queued);
+
+    // Everything was queued in whatever order the walk found it. Put groups in inode order and keep the first path to
+    // each inode alphabetically, same as the walker's own sorting and collapsing would have, so what gets kept
+    // doesn't depend on timing.
+    auto tidy = [&](std::vector<std::vector<Task>>& groups) {
+      for (auto& files : groups) {
+        std::sort(files.begin(), files.end(), [](const Task& left, const Task& right) {
+          return std::tie(left.key.dev, left.key.ino) < std::tie(right.key.dev, right.key.ino);
+        });
+        for (auto& task : files) {
+          if (task.links.empty()) {
+            continue;
+          }
+          std::vector<std::pair<std::string, PathRef>> names = {{paths.path(task.path), task.path}};
+          for (const auto& link : task.links) {
+            names.emplace_back(paths.path(link), link);
+          }
+          std::sort(names.begin(), names.end(), [](const auto& left, const auto& right) { return left.first < right.first; });
+          task.path = names.at(0).second;
+          for (std::size_t ix = 1; ix < names.size(); ++ix) {
+            task.links.at(ix - 1) = names.at(ix).second;
+          }
+        }
       }
+    };
+    tidy(duplicates);
+    tidy(probable);
+    emit(duplicates, false);
+    emit(std::exchange(probable, {}), true);
+  }
+
+  if (manifest_out) {
+    char host[256] = {};
+    gethostname(host, sizeof(host) - 1);
+    metrics.begin("manifest");
+    if (!manifest_out->write(paths, host)) {
+      logger.error("failed to write manifest: " + repr(options["manifest-out"].as_string()));
     }
+    metrics.end();
   }
 
-  if (options["wasted-space"].as_bool() and !silent) {
-    std::cout << "Wasted space from duplicate files: " << fsize(total_wasted, options["binary"].as_bool()) << '\n';
+  // Even with no duplicates at all, CSV and the manifest get their header
+  if (options["replace"].as_string() == "none" and !quiet and !silent) {
+    writer.header();
+  }
+  out.flush();
+
+  if (progress) {
+    std::cout << "\x1b[?25h";
+    std::cout.flush();
+  }
+
+  tp.stop();
+
+  for (const auto& name : {"head", "tail", "sample", "full", "verify"}) {
+    const Metrics::Phase* phase = metrics.phase(name);
+    if (phase == nullptr) {
+      continue;
+    }
+    std::string detail = std::string(name) == "verify" ? fsize(phase->total(Counter::bytes), options["binary"].as_bool()) + " read" : std::to_string(static_cast<std::size_t>(phase->noted("settled"))) + " fully compared";
+    if (auto_threads and std::string(name) != "verify") {
+      detail += ", settled on " + std::to_string(static_cast<std::size_t>(phase->noted("threads"))) + " threads";
+    }
+    logger.debug("stage " + std::string(name) + ": eliminated " + std::to_string(static_cast<std::size_t>(phase->noted("eliminated"))) + " of " + std::to_string(static_cast<std::size_t>(phase->noted("candidates"))) + " files (" + detail + ")");
+  }
+
+  if (cache) {
+    if (!cache->save()) {
+      logger.warn("failed to write hash cache: " + repr(options["cache"].as_string()));
+    }
+    logger.debug("cache: " + std::to_string(cache->hits) + " hits, " + std::to_string(cache->misses) + " misses");
+  }
+
+  if (total_probable > 0) {
+    logger.warn(std::to_string(total_probable) + " group(s) of probable duplicates were only sampled, not compared in full (use --confirm to be sure)");
   }
 
-  stats.proc_stop = now();
-  stats.overall = stats.proc_stop - stats.proc_start;
+  // Keep the machine-readable formats clean
+  std::ostream& summary = output_format == OutputFormat::text ? std::cout : std::cerr;
+
+  if (options["wasted-space"].as_bool() and !silent) {
+    summary << "Wasted space from duplicate files: " << fsize(total_wasted, options["binary"].as_bool()) << '\n';
+  }
 
   if (options["timed"].as_bool() and !silent) {
-    std::cout << "Elapsed time: " << ftime_ns(stats.overall) << "\n";
+    summary << "Elapsed time: " << ftime_ns(metrics.elapsed()) << "\n";
   }
 
   logger.debug("threads: " + options["threads"].as_string());
   logger.debug("total files found: " + std::to_string(total_walked));
+  logger.debug("hardlinks collapsed: " + std::to_string(walker.collapsed));
   logger.debug("total files hashed: " + std::to_string(total_hashed));
-  logger.debug("elapsed: parsing: " + ftime_ns(stats.parsing));
-  logger.debug("elapsed: walking: " + ftime_ns(stats.filesystem));
-  logger.debug("elapsed: hashing: " + ftime_ns(stats.hashing));
-  logger.debug("elapsed: overall: " + ftime_ns(stats.overall));
+  for (const auto& name : {"parse", "walk", "head", "tail", "sample", "full", "verify", "output"}) {
+    const Metrics::Phase* phase = metrics.phase(name);
+    if (phase == nullptr) {
+      continue;
+    }
+    double seconds = std::max<double>(phase->elapsed(), 1) / 1e9;
+    std::size_t files = phase->total(Counter::files);
+    std::size_t bytes = phase->total(Counter::bytes);
+    logger.debug("elapsed: " + std::string(name) + ": " + ftime_ns(phase->elapsed()) + " (" + std::to_string(files) + " files, " + std::to_string(static_cast<std::size_t>(files / seconds)) + " files/s, " + fsize(bytes, options["binary"].as_bool()) + " read, " + fsize(static_cast<std::size_t>(bytes / seconds), options["binary"].as_bool()) + "/s, " + std::to_string(phase->total(Counter::opens)) + " opens, " + std::to_string(phase->total(Counter::stats)) + " stats, " + std::to_string(phase->total(Counter::reads)) + " reads)");
+  }
+  logger.debug("elapsed: overall: " + ftime_ns(metrics.elapsed()));
+
+  if (!metrics.write()) {
+    logger.warn("failed to write stats: " + repr(stats_json));
+  }
 
   return 0;
 }
@@ -302,7 +977,61 @@ auto create_parser() -> parsing::ArgumentParser {
   parsing::ActionGroup& inner_group = parser.add_argument_group("General");
   inner_group.add_argument({"--threads", "-t"})
       .default_value("1")
-      .help("How many threads to use.");
+      .help("How many threads to use, or 'auto' to have the hashing threads tune their number to the throughput as they go.");
+  inner_group.add_argument({"--walk-threads"})
+      .default_value("0")
+      .help("How many threads to use for walking directories (0 to use the same number as --threads).");
+  inner_group.add_argument({"--walk-engine"})
+      .default_value("getdents")
+      .help("How to list directories: 'getdents' (raw getdents64() and one statx() per file) or 'filesystem' (std::filesystem, a few more stats per entry).");
+  inner_group.add_argument({"--head-size"})
+      .default_value("4096")
+      .help("How many bytes at the start of each candidate to compare before reading the whole file (0 to disable).");
+  inner_group.add_argument({"--tail-size"})
+      .default_value("4096")
+      .help("How many bytes at the end of each candidate to compare before reading the whole file (0 to disable).");
+  inner_group.add_argument({"--probe-hash"})
+      .default_value("xxh3-64")
+      .help("Hash for the head and tail probes: xxh3-64, xxh3-128 or crc32c. Full hashes are always XXH3-128.");
+  inner_group.add_argument({"--sample-blocks"})
+      .default_value("0")
+      .help("Fingerprint big files by hashing this many blocks spread evenly over them (along with their size), instead of reading them whole. Groups found this way are only probable duplicates. 0 to disable.");
+  inner_group.add_argument({"--sample-size"})
+      .default_value("65536")
+      .help("How big each sampled block is, with --sample-blocks.");
+  inner_group.add_argument({"--sample-threshold"})
+      .default_value("268435456")
+      .help("Only sample files at least this many bytes long. Smaller ones are hashed whole, as usual.");
+  inner_group.add_argument({"--chunk-threshold"})
+      .default_value("1073741824")
+      .help("Hash files at least this many bytes long in 64 MiB segments, on as many threads as there are segments, and combine the segment digests in a tree. 0 to always hash files in one stream.");
+  inner_group.add_argument({"--confirm"})
+      .action(parsing::actions::store_true)
+      .help("Hash groups that survive --sample-blocks in full, so that only real duplicates get reported.");
+  inner_group.add_argument({"--cache"})
+      .default_value("")
+      .help("Path to a hash cache file. Digests of unchanged files are reused from it, and new ones are saved to it.");
+  inner_group.add_argument({"--io-engine"})
+      .default_value("sync")
+      .help("How to read files: 'sync' (one blocking read at a time per thread) or 'uring' (many reads in flight per thread, using io_uring).");
+  inner_group.add_argument({"--queue-depth"})
+      .default_value("8")
+      .help("How many files each thread keeps in flight with '--io-engine uring'.");
+  inner_group.add_argument({"--mmap-threshold"})
+      .default_value("67108864")
+      .help("Hash files (or the parts of them being compared) at least this many bytes long through mmap() instead of read(). 0 to disable. Only used with '--io-engine sync'.");
+  inner_group.add_argument({"--device-threads"})
+      .default_value("0")
+      .help("How many files may be read at once from any one device (0 for auto: 1 on rotational disks, otherwise no limit beyond --threads).");
+  inner_group.add_argument({"--layout-order"})
+      .default_value("auto")
+      .help("Read candidates in on-disk order (by first extent, or by inode where that's unknown): 'on', 'off', or 'auto' (on when every disk involved is rotational).");
+  inner_group.add_argument({"--batch-size"})
+      .default_value("65536")
+      .help("Hash candidates in batches of about this many files (whole size buckets, smallest first), and output each batch's duplicates as soon as it's done. 0 to do everything in one batch.");
+  inner_group.add_argument({"--pipeline"})
+      .action(parsing::actions::store_true)
+      .help("Start hashing while the walk is still going: a size bucket goes to the threads as soon as it has a second file. Candidates then go through as one batch, ignoring --batch-size.");
   inner_group.add_argument({"--recursive", "-r"})
       .action(parsing::actions::store_true)
       .help("Walk all subdirectories of SOURCES.");
@@ -311,13 +1040,28 @@ auto create_parser() -> parsing::ArgumentParser {
       .help("Skip empty files (all empty files hash to the same value, so it's worth skipping them. This may default to true in the future.).");
   inner_group.add_argument({"--replace"})
       .default_value("none")
-      .help("Replace duplicate files with either a hardlink or a symlink to the original.");
+      .help("Replace duplicate files with a hardlink or a symlink to the original, or (reflink) have them share its data blocks on filesystems that can, keeping them separate files. Links are renamed over the duplicate, so no path is ever missing.");
+  inner_group.add_argument({"--verify"})
+      .action(parsing::actions::store_true)
+      .help("Compare candidates byte for byte (all members of a group in lockstep) instead of trusting the full hash.");
+  inner_group.add_argument({"--max-open"})
+      .default_value("256")
+      .help("How many files '--verify' may keep open at once. Bigger groups still work, just with more open() calls.");
   inner_group.add_argument({"--dryrun"})
       .action(parsing::actions::store_true)
       .help("Don't actually take any actions. Just print what would have been done.");
   inner_group.add_argument({"--si", "--binary"})
       .action(parsing::actions::store_true)
       .help("Use binary prefixes (KiB, MiB, etc.) instead of the default (KB, MB, etc.).");
+  inner_group.add_argument({"--manifest-out"})
+      .default_value("")
+      .help("Also write every file's size, digests and path to this file, sorted, for '--merge' to compare against other hosts' later. Every file gets hashed in full, not just the ones with a match here.");
+  inner_group.add_argument({"--merge"})
+      .action(parsing::actions::store_true)
+      .help("Don't scan anything. SOURCES are manifests from '--manifest-out', and the duplicates between them are printed as HOST:PATH, without reading any file data.");
+  inner_group.add_argument({"--format"})
+      .default_value("text")
+      .help("How duplicates are written: 'text' (a path per line, a blank line between groups), 'jsonl' (a JSON object per group, with its size, digest, and every file's device and inode), 'csv' (a row per file), or 'binary' (a compact manifest, see the README).");
   inner_group.add_argument({"--zero"})
       .dest("separator")
       .default_value("\n")
@@ -346,6 +1090,9 @@ auto create_parser() -> parsing::ArgumentParser {
   info_group.add_argument({"--progress"})
       .action(parsing::actions::store_true)
       .help("Show a helpful progress bar instead of the nothing that currently gets shown.");
+  info_group.add_argument({"--stats-json"})
+      .default_value("")
+      .help("Write per-phase metrics (throughput, syscalls, per-thread busy/idle time, queue depth over time, hit rates) as JSON to this file ('-' for stderr) at exit, and whenever SIGUSR1 arrives.");
   info_group.add_argument({"--timed"})
       .action(parsing::actions::store_true)
       .help("Show elapsed time from the moment parsing has finished to the moment the program is done doing its work.");
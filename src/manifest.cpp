@@ -0,0 +1,284 @@
+#include "manifest.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <queue>
+#include <tuple>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+
+#include "output.hpp"
+
+
+namespace manifest {
+
+static constexpr char magic[8] = {'X', 'D', 'M', 'A', 'N', 'I', 'F', '2'};
+static constexpr std::uint32_t byte_order_mark = 0x01020304;
+// XXH3-128, or a tree of them for chunked files (see ThreadPool::finish_segment)
+static constexpr std::uint32_t digest_scheme = 1;
+
+// Entries per read while merging
+static constexpr std::size_t block_entries = 4096;
+
+
+auto operator<(const Entry& left, const Entry& right) -> bool {
+  return std::tie(left.size, left.high, left.low) < std::tie(right.size, right.high, right.low);
+}
+
+static auto same(const Entry& left, const Entry& right) -> bool {
+  return left.size == right.size and left.high == right.high and left.low == right.low;
+}
+
+
+Writer::Writer(std::string path, std::uint64_t chunk_threshold) : path(std::move(path)), chunk_threshold(chunk_threshold) {}
+
+// Links to the same inode are left out, since they'd only ever be duplicates of each other
+auto Writer::add(const Task& task) -> void {
+  entries.push_back({task.size, task.digest.low64, task.digest.high64, task.probes[0], task.probes[1], task.key.dev, task.key.ino, task.path.name, task.path.dir, 0});
+}
+
+auto Writer::write(const PathTable& paths, const std::string& host) -> bool {
+  std::sort(entries.begin(), entries.end());
+
+  // Relative paths mean nothing on another host
+  char buffer[PATH_MAX];
+  std::string cwd = getcwd(buffer, sizeof(buffer)) != nullptr ? buffer : "";
+
+  // Only the directories that are actually used get written, numbered in the order they first come up
+  std::unordered_map<std::uint32_t, std::uint32_t> renumbered;
+  std::vector<std::string> dirs;
+  std::uint64_t names_size = 0;
+  for (const auto& entry : entries) {
+    if (renumbered.emplace(entry.dir, static_cast<std::uint32_t>(dirs.size())).second) {
+      dirs.push_back(paths.dir_path(entry.dir));
+      if (dirs.back().front() != '/' and !cwd.empty()) {
+        dirs.back() = cwd + '/' + dirs.back();
+      }
+    }
+    names_size += std::strlen(paths.name({entry.dir, entry.name})) + 1;
+  }
+  std::uint64_t dirs_size = 0;
+  for (const auto& dir : dirs) {
+    dirs_size += sizeof(std::uint32_t) + dir.size();
+  }
+
+  Header header = {};
+  std::memcpy(header.magic, magic, sizeof(magic));
+  header.byte_order = byte_order_mark;
+  header.entry_size = sizeof(Entry);
+  header.entries = entries.size();
+  header.host_size = host.size();
+  header.digest_scheme = digest_scheme;
+  header.chunk_threshold = chunk_threshold;
+  header.chunk_segment = chunk_segment;
+  header.names_offset = sizeof(Header) + host.size();
+  header.dirs = dirs.size();
+  header.dir_index_offset = header.names_offset + names_size + dirs_size;
+  header.entries_offset = header.dir_index_offset + dirs.size() * sizeof(std::uint64_t);
+
+  std::string tmp = path + ".tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+
+  bool ok;
+  {
+    OutputBuffer out(fd);
+    out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.append(host);
+
+    std::uint64_t offset = 0;
+    for (auto& entry : entries) {
+      const char* name = paths.name({entry.dir, entry.name});
+      std::size_t length = std::strlen(name) + 1;
+      out.append(name, length);
+      entry.name = offset;
+      entry.dir = renumbered.at(entry.dir);
+      offset += length;
+    }
+
+    std::vector<std::uint64_t> index;
+    index.reserve(dirs.size());
+    offset = header.names_offset + names_size;
+    for (const auto& dir : dirs) {
+      index.push_back(offset);
+      auto length = static_cast<std::uint32_t>(dir.size());
+      out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+      out.append(dir);
+      offset += sizeof(length) + dir.size();
+    }
+    out.append(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(std::uint64_t));
+    out.append(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(Entry));
+    ok = out.flush();
+  }
+  ok = close(fd) == 0 and ok;
+  if (!ok or std::rename(tmp.c_str(), path.c_str()) != 0) {
+    std::remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+
+Reader::Reader(std::string path) : file(std::move(path)) {}
+
+Reader::~Reader() {
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+Reader::Reader(Reader&& other) noexcept
+    : host(std::move(other.host)), file(std::move(other.file)), failed(other.failed), fd(std::exchange(other.fd, -1)), header(other.header),
+      block(std::move(other.block)), cursor(other.cursor), consumed(other.consumed) {}
+
+auto Reader::read(void* out, std::size_t length, std::uint64_t offset) -> bool {
+  std::size_t done = 0;
+  while (done < length) {
+    ssize_t got = pread(fd, static_cast<char*>(out) + done, length - done, offset + done);
+    if (got <= 0) {
+      return false;
+    }
+    done += got;
+  }
+  return true;
+}
+
+auto Reader::open() -> bool {
+  fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    error = std::strerror(errno);
+    return false;
+  }
+  if (!read(&header, sizeof(header), 0) or std::memcmp(header.magic, magic, sizeof(magic)) != 0) {
+    error = "not a manifest";
+    return false;
+  }
+  if (header.byte_order != byte_order_mark or header.entry_size != sizeof(Entry)) {
+    error = "written on a host with another byte order or entry layout";
+    return false;
+  }
+  host.resize(header.host_size);
+  if (!read(host.data(), host.size(), sizeof(header))) {
+    error = "cut short";
+    return false;
+  }
+  posix_fadvise(fd, header.entries_offset, 0, POSIX_FADV_SEQUENTIAL);
+  return true;
+}
+
+auto Reader::next(Entry& entry) -> bool {
+  if (cursor == block.size()) {
+    if (consumed == header.entries) {
+      return false;
+    }
+    block.resize(std::min<std::uint64_t>(block_entries, header.entries - consumed));
+    if (!read(block.data(), block.size() * sizeof(Entry), header.entries_offset + consumed * sizeof(Entry))) {
+      failed = true;
+      return false;
+    }
+    consumed += block.size();
+    cursor = 0;
+  }
+  entry = block[cursor++];
+  return true;
+}
+
+auto Reader::same_digests(const Reader& other) const -> bool {
+  return header.digest_scheme == other.header.digest_scheme and header.chunk_threshold == other.header.chunk_threshold and
+         header.chunk_segment == other.header.chunk_segment;
+}
+
+auto Reader::chunk_threshold() const -> std::uint64_t {
+  return header.chunk_threshold;
+}
+
+// Names can't be longer than NAME_MAX, so one read of that much always gets all of it
+auto Reader::path(const Entry& entry) -> std::string {
+  std::uint64_t offset;
+  std::uint32_t length;
+  if (entry.dir >= header.dirs or !read(&offset, sizeof(offset), header.dir_index_offset + entry.dir * sizeof(offset)) or !read(&length, sizeof(length), offset)) {
+    return "";
+  }
+  std::string out(length, '\0');
+  char name[256];
+  ssize_t got = pread(fd, name, sizeof(name), header.names_offset + entry.name);
+  if (!read(out.data(), length, offset + sizeof(length)) or got <= 0) {
+    return "";
+  }
+  out += '/';
+  out.append(name, strnlen(name, got));
+  return out;
+}
+
+
+auto merge(std::vector<Reader>& readers, const std::function<void(std::size_t, const Entry&, bool)>& found, std::string& error) -> bool {
+  // Equal files would have different digests, so the merge would quietly find nothing
+  for (const auto& reader : readers) {
+    if (!reader.same_digests(readers.front())) {
+      error = "can't merge manifests with differently taken digests: " + readers.front().file + " has --chunk-threshold " +
+              std::to_string(readers.front().chunk_threshold()) + ", " + reader.file + " has " + std::to_string(reader.chunk_threshold());
+      return false;
+    }
+  }
+
+  // Equal entries come out in the order the manifests were given, so a group can be passed on as it goes
+  using Item = std::pair<Entry, std::size_t>;
+  auto later = [](const Item& left, const Item& right) { return right.first < left.first or (same(left.first, right.first) and right.second < left.second); };
+  std::priority_queue<Item, std::vector<Item>, decltype(later)> heap(later);
+
+  // What every manifest has next. Each one is sorted, so when a group starts, anything else in it is at the front.
+  std::vector<Entry> heads(readers.size());
+  std::vector<bool> live(readers.size(), false);
+  auto advance = [&](std::size_t ix) {
+    live.at(ix) = readers.at(ix).next(heads.at(ix));
+    if (live.at(ix)) {
+      heap.push({heads.at(ix), ix});
+    }
+  };
+  for (std::size_t ix = 0; ix < readers.size(); ++ix) {
+    advance(ix);
+  }
+
+  // Duplicates within one manifest were already reported by the scan that wrote it, so a group only counts if another
+  // manifest has a part in it. Entries without a full digest can't be matched with anything.
+  Entry current = {};
+  bool started = false;
+  bool reporting = false;
+  while (!heap.empty()) {
+    auto [top, ix] = heap.top();
+    heap.pop();
+    advance(ix);
+    if (!started or !same(current, top)) {
+      started = true;
+      current = top;
+      reporting = false;
+      if (top.low != 0 or top.high != 0) {
+        for (std::size_t other = ix + 1; other < readers.size() and !reporting; ++other) {
+          reporting = live.at(other) and same(heads.at(other), top);
+        }
+      }
+      if (reporting) {
+        found(ix, top, true);
+      }
+      continue;
+    }
+    if (reporting) {
+      found(ix, top, false);
+    }
+  }
+
+  if (std::any_of(readers.begin(), readers.end(), [](const Reader& reader) { return reader.failed; })) {
+    error = "a manifest was cut short, so some duplicates may be missing";
+    return false;
+  }
+  return true;
+}
+
+}
@@ -0,0 +1,62 @@
+#include "mapped.hpp"
+
+#include <csetjmp>
+#include <csignal>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+// Where to jump back to if this thread faults on a mapping. Null whenever the thread isn't inside feed_mapped().
+static thread_local sigjmp_buf* sigbus_target = nullptr;
+
+static void sigbus_handler(int sig, siginfo_t*, void*) {
+  if (sigbus_target != nullptr) {
+    siglongjmp(*sigbus_target, 1);
+  }
+  // Not ours, so die the way we would have without the handler
+  std::signal(sig, SIG_DFL);
+  std::raise(sig);
+}
+
+void install_sigbus_handler() {
+  struct sigaction action = {};
+  action.sa_sigaction = sigbus_handler;
+  action.sa_flags = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGBUS, &action, nullptr);
+}
+
+auto feed_mapped(int fd, std::size_t offset, std::size_t length, void (*feed)(void*, const void*, std::size_t), void* context) -> Mapped {
+  if (length == 0) {
+    return Mapped::complete;
+  }
+
+  // Mappings have to start on a page boundary
+  static const std::size_t page_size = sysconf(_SC_PAGESIZE);
+  std::size_t skip = offset % page_size;
+  std::size_t map_length = length + skip;
+
+  void* mapping = mmap(nullptr, map_length, PROT_READ, MAP_PRIVATE, fd, offset - skip);
+  if (mapping == MAP_FAILED) {
+    return Mapped::unmapped;
+  }
+  madvise(mapping, map_length, MADV_SEQUENTIAL);
+
+  const char* data = static_cast<const char*>(mapping) + skip;
+  Mapped result = Mapped::complete;
+
+  sigjmp_buf target;
+  if (sigsetjmp(target, 1) == 0) {
+    sigbus_target = &target;
+    feed(context, data, length);
+  }
+  else {
+    // Came back from the SIGBUS handler. The file shrank, so whatever was fed is garbage.
+    result = Mapped::truncated;
+  }
+  sigbus_target = nullptr;
+
+  munmap(mapping, map_length);
+  return result;
+}
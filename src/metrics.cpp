@@ -0,0 +1,319 @@
+#include "metrics.hpp"
+
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+
+#include "utils.hpp"
+
+
+static volatile std::sig_atomic_t report_requested = 0;
+
+static void request_report(int) {
+  report_requested = 1;
+}
+
+
+auto ThreadCounters::add(Counter counter, std::uint64_t amount) -> void {
+  auto& value = values[static_cast<std::size_t>(counter)];
+  value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+auto ThreadCounters::idle_begin() -> void {
+  idle_since.store(now(), std::memory_order_relaxed);
+}
+
+auto ThreadCounters::idle_end() -> void {
+  add(Counter::idle_ns, now() - idle_since.load(std::memory_order_relaxed));
+  idle_since.store(0, std::memory_order_relaxed);
+}
+
+auto ThreadCounters::snapshot() const -> CounterValues {
+  CounterValues out;
+  for (std::size_t ix = 0; ix < counter_count; ++ix) {
+    out[ix] = values[ix].load(std::memory_order_relaxed);
+  }
+  std::uint64_t since = idle_since.load(std::memory_order_relaxed);
+  if (since != 0) {
+    out[static_cast<std::size_t>(Counter::idle_ns)] += now() - since;
+  }
+  return out;
+}
+
+
+auto Metrics::Phase::elapsed() const -> std::uint64_t {
+  return accumulated_ns + (running ? now() - start_ns : 0);
+}
+
+// Every thread's counters for the phase so far, including the stretch that is running right now
+auto Metrics::Phase::per_thread() const -> std::vector<CounterValues> {
+  std::vector<CounterValues> out = deltas;
+  out.resize(sources.size(), CounterValues{});
+  if (running) {
+    for (std::size_t ix = 0; ix < sources.size(); ++ix) {
+      CounterValues values = sources[ix]->snapshot();
+      for (std::size_t counter = 0; counter < counter_count; ++counter) {
+        out[ix][counter] += values[counter] - first[ix][counter];
+      }
+    }
+  }
+  return out;
+}
+
+auto Metrics::Phase::total(Counter counter) const -> std::uint64_t {
+  std::uint64_t sum = 0;
+  for (const auto& values : per_thread()) {
+    sum += values[static_cast<std::size_t>(counter)];
+  }
+  return sum;
+}
+
+auto Metrics::Phase::noted(const std::string& key) const -> double {
+  for (const auto& [name, value] : notes) {
+    if (name == key) {
+      return value;
+    }
+  }
+  return 0;
+}
+
+
+Metrics::Metrics() : start_ns(now()) {}
+
+Metrics::~Metrics() {
+  stopping = true;
+  sampler_wake.notify_all();
+  if (sampler.joinable()) {
+    sampler.join();
+  }
+}
+
+// Start (or pick up again) a phase, ending whichever one is running. `threads` are the counters of whoever works in
+// it, and `depth` (if given) says how much work is queued up right now.
+auto Metrics::begin(const std::string& name, std::vector<const ThreadCounters*> threads, std::function<std::size_t()> depth) -> void {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (active) {
+    finish(phases.at(current));
+  }
+  current = 0;
+  while (current < phases.size() and phases.at(current).name != name) {
+    current++;
+  }
+  if (current == phases.size()) {
+    phases.emplace_back();
+    phases.back().name = name;
+  }
+  Phase& phase = phases.at(current);
+  phase.running = true;
+  phase.start_ns = now();
+  phase.sources = std::move(threads);
+  phase.first.clear();
+  for (const auto* source : phase.sources) {
+    phase.first.push_back(source->snapshot());
+  }
+  phase.depth = std::move(depth);
+  active = true;
+}
+
+// Add a number to the running (or last started) phase
+auto Metrics::note(const std::string& key, double value) -> void {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (phases.empty()) {
+    return;
+  }
+  auto& notes = phases.at(current).notes;
+  for (auto& [name, total] : notes) {
+    if (name == key) {
+      total += value;
+      return;
+    }
+  }
+  notes.emplace_back(key, value);
+}
+
+// Like note(), but for numbers that don't add up across batches: the last one wins
+auto Metrics::set(const std::string& key, double value) -> void {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (phases.empty()) {
+    return;
+  }
+  auto& notes = phases.at(current).notes;
+  for (auto& [name, last] : notes) {
+    if (name == key) {
+      last = value;
+      return;
+    }
+  }
+  notes.emplace_back(key, value);
+}
+
+auto Metrics::end() -> void {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (active) {
+    finish(phases.at(current));
+    active = false;
+  }
+}
+
+auto Metrics::finish(Phase& phase) -> void {
+  phase.deltas = phase.per_thread();
+  phase.accumulated_ns += now() - phase.start_ns;
+  phase.running = false;
+  // Nobody else can be asked for the depth once the phase is over
+  phase.depth = nullptr;
+}
+
+auto Metrics::phase(const std::string& name) const -> const Phase* {
+  std::unique_lock<std::mutex> lock(mutex);
+  for (const auto& candidate : phases) {
+    if (candidate.name == name) {
+      return &candidate;
+    }
+  }
+  return nullptr;
+}
+
+auto Metrics::elapsed() const -> std::uint64_t {
+  return now() - start_ns;
+}
+
+// Numbers go out as integers whenever they are whole, which keeps the counters readable
+static auto number(double value) -> std::string {
+  std::ostringstream out;
+  if (std::isfinite(value) and value == std::floor(value) and std::fabs(value) < 1e18) {
+    out << static_cast<long long>(value);
+  }
+  else {
+    out.precision(6);
+    out << (std::isfinite(value) ? value : 0.0);
+  }
+  return out.str();
+}
+
+auto Metrics::render(const Phase& phase, std::uint64_t elapsed_ns) const -> std::string {
+  static const std::array<const char*, counter_count> names = {"files", "bytes", "dirs", "opens", "stats", "reads", "idle_ns"};
+
+  std::vector<CounterValues> per_thread = phase.per_thread();
+
+  CounterValues totals = {};
+  for (const auto& values : per_thread) {
+    for (std::size_t counter = 0; counter < counter_count; ++counter) {
+      totals[counter] += values[counter];
+    }
+  }
+
+  double seconds = std::max<double>(elapsed_ns, 1) / 1e9;
+
+  std::ostringstream out;
+  out << "{\"name\": \"" << phase.name << "\", \"running\": " << (phase.running ? "true" : "false")
+      << ", \"elapsed_ns\": " << elapsed_ns;
+  for (std::size_t counter = 0; counter < counter_count; ++counter) {
+    out << ", \"" << names[counter] << "\": " << totals[counter];
+  }
+  out << ", \"files_per_s\": " << number(std::round(totals[0] / seconds))
+      << ", \"mb_per_s\": " << number(totals[1] / seconds / 1e6);
+  for (const auto& [key, value] : phase.notes) {
+    out << ", \"" << key << "\": " << number(value);
+  }
+  // Rates only make sense over the totals, so they are worked out here rather than noted
+  if (phase.noted("candidates") > 0) {
+    out << ", \"elimination_rate\": " << number(phase.noted("eliminated") / phase.noted("candidates"));
+  }
+  if (phase.noted("cache_hits") + phase.noted("cache_misses") > 0) {
+    out << ", \"cache_hit_rate\": " << number(phase.noted("cache_hits") / (phase.noted("cache_hits") + phase.noted("cache_misses")));
+  }
+
+  out << ", \"threads\": [";
+  for (std::size_t ix = 0; ix < per_thread.size(); ++ix) {
+    std::uint64_t idle = std::min<std::uint64_t>(per_thread[ix][static_cast<std::size_t>(Counter::idle_ns)], elapsed_ns);
+    out << (ix == 0 ? "" : ", ") << "{\"busy_ns\": " << elapsed_ns - idle << ", \"idle_ns\": " << idle
+        << ", \"files\": " << per_thread[ix][0] << ", \"bytes\": " << per_thread[ix][1] << "}";
+  }
+  out << "], \"queue_depth\": [";
+  for (std::size_t ix = 0; ix < phase.samples.size(); ++ix) {
+    out << (ix == 0 ? "" : ", ") << "[" << phase.samples[ix].first << ", " << phase.samples[ix].second << "]";
+  }
+  out << "]}";
+  return out.str();
+}
+
+auto Metrics::json() -> std::string {
+  std::unique_lock<std::mutex> lock(mutex);
+  std::ostringstream out;
+  out << "{\"elapsed_ns\": " << elapsed() << ", \"phases\": [";
+  for (std::size_t ix = 0; ix < phases.size(); ++ix) {
+    out << (ix == 0 ? "" : ", ") << render(phases[ix], phases[ix].elapsed());
+  }
+  out << "]}";
+  return out.str();
+}
+
+// Written under a temporary name and renamed into place, so whatever is watching the file never sees half of it.
+auto Metrics::write() -> bool {
+  if (path.empty()) {
+    return true;
+  }
+  std::unique_lock<std::mutex> lock(write_mutex);
+  std::string document = json();
+  if (path == "-") {
+    std::cerr << document << std::endl;
+    return true;
+  }
+  std::string tmp = path + ".tmp";
+  std::FILE* fp = std::fopen(tmp.c_str(), "w");
+  if (fp == nullptr) {
+    return false;
+  }
+  bool ok = std::fwrite(document.data(), 1, document.size(), fp) == document.size() and std::fputc('\n', fp) != EOF;
+  ok = std::fclose(fp) == 0 and ok;
+  if (!ok or std::rename(tmp.c_str(), path.c_str()) != 0) {
+    std::remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+auto Metrics::report_to(const std::string& destination) -> void {
+  path = destination;
+  std::signal(SIGUSR1, request_report);
+  sampler = std::thread(&Metrics::sample, this);
+}
+
+// Wakes up every few milliseconds to sample the running phase's queue depth, and to answer SIGUSR1.
+auto Metrics::sample() -> void {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(sampler_mutex);
+      sampler_wake.wait_for(lock, std::chrono::milliseconds(10), [this] { return stopping.load(); });
+    }
+    if (stopping) {
+      break;
+    }
+
+    if (report_requested) {
+      report_requested = 0;
+      write();
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!active or !phases.at(current).depth) {
+      continue;
+    }
+    Phase& phase = phases.at(current);
+    std::uint64_t at = phase.elapsed();
+    if (!phase.samples.empty() and at - phase.samples.back().first * 1'000'000 < phase.sample_every_ns) {
+      continue;
+    }
+    phase.samples.emplace_back(at / 1'000'000, phase.depth());
+    // Keep every other sample and halve the rate, so a long phase costs no more than a short one
+    if (phase.samples.size() >= 512) {
+      for (std::size_t ix = 0; ix < phase.samples.size() / 2; ++ix) {
+        phase.samples[ix] = phase.samples[ix * 2];
+      }
+      phase.samples.resize(phase.samples.size() / 2);
+      phase.sample_every_ns *= 2;
+    }
+  }
+}
@@ -0,0 +1,280 @@
+#include "output.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+
+
+OutputBuffer::OutputBuffer(int fd, std::size_t capacity) : fd(fd), buffer(std::max<std::size_t>(capacity, 4096)) {}
+
+OutputBuffer::~OutputBuffer() {
+  flush();
+}
+
+auto OutputBuffer::append(const char* data, std::size_t length) -> void {
+  if (used + length > buffer.size()) {
+    flush();
+    // Doesn't fit even in an empty buffer, so skip the copy
+    if (length > buffer.size()) {
+      std::cout.flush();
+      while (length > 0 and !failed) {
+        ssize_t wrote = ::write(fd, data, length);
+        if (wrote < 0 and errno == EINTR) {
+          continue;
+        }
+        failed = wrote <= 0;
+        data += wrote > 0 ? wrote : 0;
+        length -= wrote > 0 ? wrote : 0;
+      }
+      return;
+    }
+  }
+  std::memcpy(buffer.data() + used, data, length);
+  used += length;
+}
+
+auto OutputBuffer::append(const std::string& data) -> void {
+  append(data.data(), data.size());
+}
+
+auto OutputBuffer::put(char c) -> void {
+  if (used == buffer.size()) {
+    flush();
+  }
+  buffer[used++] = c;
+}
+
+// Once a write fails (the reader went away, say), everything after it gets dropped instead of retried
+auto OutputBuffer::flush() -> bool {
+  std::cout.flush();
+  std::size_t done = 0;
+  while (done < used and !failed) {
+    ssize_t wrote = ::write(fd, buffer.data() + done, used - done);
+    if (wrote < 0 and errno == EINTR) {
+      continue;
+    }
+    failed = wrote <= 0;
+    done += wrote > 0 ? wrote : 0;
+  }
+  used = 0;
+  return !failed;
+}
+
+
+ResultWriter::ResultWriter(OutputFormat format, char separator, const PathTable& paths, OutputBuffer& out)
+    : format(format), separator(separator), paths(paths), out(out), dirs(4096, {PathTable::no_parent, {}}) {}
+
+auto ResultWriter::group(const std::vector<Task>& files, bool probable) -> void {
+  bool digested = files.at(0).digest.low64 != 0 or files.at(0).digest.high64 != 0;
+  header();
+  switch (format) {
+  case OutputFormat::text:
+    text(files);
+    break;
+  case OutputFormat::jsonl:
+    jsonl(files, probable, digested);
+    break;
+  case OutputFormat::csv:
+    csv(files, probable, digested);
+    break;
+  case OutputFormat::binary:
+    binary(files, probable, digested);
+    break;
+  }
+  groups++;
+}
+
+// CSV and the manifest start with one, even with nothing after it
+auto ResultWriter::header() -> void {
+  if (started) {
+    return;
+  }
+  started = true;
+  if (format == OutputFormat::csv) {
+    out.append("group,size,digest,probable,device,inode,path\n");
+  }
+  else if (format == OutputFormat::binary) {
+    out.append("XDUPES\0\1", 8);
+  }
+}
+
+// Building a directory's path means walking up the directory table, which costs more than all the formatting put
+// together, so recent ones are kept around. Direct mapped, like DirHandles.
+auto ResultWriter::path(PathRef ref) -> const std::string& {
+  auto& [dir, dir_path] = dirs[ref.dir % dirs.size()];
+  if (dir != ref.dir) {
+    dir = ref.dir;
+    dir_path = paths.dir_path(ref.dir);
+  }
+  scratch.assign(dir_path);
+  scratch += '/';
+  scratch += paths.name(ref);
+  return scratch;
+}
+
+// Nothing but paths, since scripts read them back as such. Probable groups get warned about on stderr instead.
+auto ResultWriter::text(const std::vector<Task>& files) -> void {
+  for (const auto& file : files) {
+    out.append(path(file.path));
+    out.put(separator);
+    for (const auto& link : file.links) {
+      out.append(path(link));
+      out.put(separator);
+    }
+  }
+  out.put(separator);
+}
+
+auto ResultWriter::number(std::uint64_t value) -> void {
+  char digits[20];
+  std::size_t first = sizeof(digits);
+  do {
+    digits[--first] = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  out.append(digits + first, sizeof(digits) - first);
+}
+
+// High half first, so it reads like XXH128's canonical form
+auto ResultWriter::digest(const Task& file) -> void {
+  static const char hex[] = "0123456789abcdef";
+  char digits[32];
+  for (std::size_t ix = 0; ix < 16; ++ix) {
+    digits[15 - ix] = hex[(file.digest.high64 >> (ix * 4)) & 0xf];
+    digits[31 - ix] = hex[(file.digest.low64 >> (ix * 4)) & 0xf];
+  }
+  out.append(digits, sizeof(digits));
+}
+
+// A JSON string. Bytes that aren't valid UTF-8 go through as they are, since a path is just bytes.
+auto ResultWriter::quoted(const std::string& value) -> void {
+  static const char hex[] = "0123456789abcdef";
+  out.put('"');
+  // Runs of characters that need no escaping go out in one piece
+  std::size_t clean = 0;
+  for (std::size_t ix = 0; ix < value.size(); ++ix) {
+    auto byte = static_cast<unsigned char>(value[ix]);
+    if (byte >= 0x20 and byte != '"' and byte != '\\') {
+      continue;
+    }
+    out.append(value.data() + clean, ix - clean);
+    clean = ix + 1;
+    if (byte < 0x20) {
+      char escaped[] = {'\\', 'u', '0', '0', hex[byte >> 4], hex[byte & 0xf]};
+      out.append(escaped, sizeof(escaped));
+    }
+    else {
+      char escaped[] = {'\\', static_cast<char>(byte)};
+      out.append(escaped, sizeof(escaped));
+    }
+  }
+  out.append(value.data() + clean, value.size() - clean);
+  out.put('"');
+}
+
+auto ResultWriter::jsonl(const std::vector<Task>& files, bool probable, bool digested) -> void {
+  out.append("{\"size\": ");
+  number(files.at(0).size);
+  out.append(", \"digest\": ");
+  if (digested) {
+    out.put('"');
+    digest(files.at(0));
+    out.put('"');
+  }
+  else {
+    out.append("null");
+  }
+  out.append(probable ? ", \"probable\": true, \"files\": [" : ", \"probable\": false, \"files\": [");
+  for (std::size_t ix = 0; ix < files.size(); ++ix) {
+    const Task& file = files.at(ix);
+    out.append(ix == 0 ? "{\"path\": " : ", {\"path\": ");
+    quoted(path(file.path));
+    out.append(", \"device\": ");
+    number(file.key.dev);
+    out.append(", \"inode\": ");
+    number(file.key.ino);
+    if (!file.links.empty()) {
+      out.append(", \"links\": [");
+      for (std::size_t link = 0; link < file.links.size(); ++link) {
+        if (link > 0) {
+          out.append(", ");
+        }
+        quoted(path(file.links.at(link)));
+      }
+      out.put(']');
+    }
+    out.put('}');
+  }
+  out.append("]}\n");
+}
+
+// One row per path, so a hardlink gets a row of its own with the same device and inode as the file it's a link to
+auto ResultWriter::csv(const std::vector<Task>& files, bool probable, bool digested) -> void {
+  for (const auto& file : files) {
+    csv_row(file, path(file.path), probable, digested);
+    for (const auto& link : file.links) {
+      csv_row(file, path(link), probable, digested);
+    }
+  }
+}
+
+// RFC 4180: a field with a comma, quote or line break in it gets quoted, with its quotes doubled
+auto ResultWriter::csv_row(const Task& file, const std::string& field, bool probable, bool digested) -> void {
+  number(groups);
+  out.put(',');
+  number(file.size);
+  out.put(',');
+  if (digested) {
+    digest(file);
+  }
+  out.append(probable ? ",1," : ",0,");
+  number(file.key.dev);
+  out.put(',');
+  number(file.key.ino);
+  out.put(',');
+  if (field.find_first_of(",\"\r\n") == std::string::npos) {
+    out.append(field);
+  }
+  else {
+    out.put('"');
+    for (char c : field) {
+      if (c == '"') {
+        out.put('"');
+      }
+      out.put(c);
+    }
+    out.put('"');
+  }
+  out.put('\n');
+}
+
+auto ResultWriter::integer(std::uint64_t value, std::size_t bytes) -> void {
+  char raw[8];
+  for (std::size_t ix = 0; ix < bytes; ++ix) {
+    raw[ix] = static_cast<char>(value >> (ix * 8));
+  }
+  out.append(raw, bytes);
+}
+
+auto ResultWriter::binary(const std::vector<Task>& files, bool probable, bool digested) -> void {
+  integer(files.at(0).size, 8);
+  integer(digested ? files.at(0).digest.low64 : 0, 8);
+  integer(digested ? files.at(0).digest.high64 : 0, 8);
+  integer((probable ? 1 : 0) | (digested ? 0 : 2), 1);
+  integer(files.size(), 4);
+  for (const auto& file : files) {
+    integer(file.key.dev, 8);
+    integer(file.key.ino, 8);
+    integer(1 + file.links.size(), 4);
+    const std::string& first = path(file.path);
+    integer(first.size(), 4);
+    out.append(first);
+    for (const auto& link : file.links) {
+      const std::string& other = path(link);
+      integer(other.size(), 4);
+      out.append(other);
+    }
+  }
+}
@@ -0,0 +1,90 @@
+#include "paths.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <unistd.h>
+
+
+auto PathTable::add_dir(std::uint32_t parent, std::string name) -> std::uint32_t {
+  std::unique_lock<std::shared_mutex> lock(mutex);
+  dirs.push_back({parent, dir_names.size()});
+  dir_names.insert(dir_names.end(), name.begin(), name.end());
+  dir_names.push_back('\0');
+  return static_cast<std::uint32_t>(dirs.size() - 1);
+}
+
+// Walk up to the root, then glue the names back together on the way down.
+auto PathTable::dir_path(std::uint32_t dir) const -> std::string {
+  std::shared_lock<std::shared_mutex> lock(mutex);
+  std::vector<const char*> parts;
+  for (std::uint32_t ix = dir; ix != no_parent; ix = dirs.at(ix).parent) {
+    parts.push_back(dir_names.data() + dirs.at(ix).name);
+  }
+  std::string out;
+  for (auto it = parts.rbegin(); it != parts.rend(); ++it) {
+    if (it != parts.rbegin()) {
+      out += '/';
+    }
+    out += *it;
+  }
+  return out;
+}
+
+// File names never get anywhere near a chunk's size, so a name that doesn't fit just starts a new one.
+auto PathTable::add_name(Arena& arena, const char* name) -> std::uint64_t {
+  std::size_t length = std::strlen(name) + 1;
+  if (arena.chunk == nullptr or arena.used + length > chunk_size) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    chunks.emplace_back(new char[chunk_size]);
+    arena.chunk = chunks.back().get();
+    arena.base = static_cast<std::uint64_t>(chunks.size() - 1) << chunk_bits;
+    arena.used = 0;
+  }
+  std::memcpy(arena.chunk + arena.used, name, length);
+  std::uint64_t offset = arena.base + arena.used;
+  arena.used += length;
+  return offset;
+}
+
+auto PathTable::name(PathRef ref) const -> const char* {
+  std::shared_lock<std::shared_mutex> lock(mutex);
+  return chunks.at(ref.name >> chunk_bits).get() + (ref.name & (chunk_size - 1));
+}
+
+auto PathTable::path(PathRef ref) const -> std::string {
+  return dir_path(ref.dir) + '/' + name(ref);
+}
+
+
+DirHandles::DirHandles(const PathTable& paths, std::size_t capacity) : paths(paths), slots(std::max<std::size_t>(capacity, 1)) {}
+
+DirHandles::~DirHandles() {
+  for (auto& slot : slots) {
+    if (slot.fd >= 0) {
+      close(slot.fd);
+    }
+  }
+}
+
+auto DirHandles::dir(std::uint32_t dir) -> int {
+  Slot& slot = slots.at(dir % slots.size());
+  if (slot.dir != dir) {
+    if (slot.fd >= 0) {
+      close(slot.fd);
+    }
+    slot.dir = dir;
+    slot.fd = ::open(paths.dir_path(dir).c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+  }
+  return slot.fd;
+}
+
+auto DirHandles::open(PathRef ref, int flags) -> int {
+  int fd = dir(ref.dir);
+  // Couldn't get at the directory itself (say, it was swapped out for a symlink). Let the kernel resolve the lot.
+  if (fd < 0) {
+    return ::open(paths.path(ref).c_str(), flags);
+  }
+  return ::openat(fd, paths.name(ref), flags);
+}
@@ -1,11 +1,34 @@
 #include "progressbar.hpp"
+#include "utils.hpp"
 
+#include <csignal>
+#include <cstdio>
+#include <unistd.h>
 
 
-ProgressBar::ProgressBar(std::size_t total) : total(total), subtotal(0) {}
+// Set by SIGWINCH, and at first, so the width gets looked up once
+static std::atomic<bool> resized = true;
+static winsize cached_winsize = {};
 
+static void on_resize(int) {
+  resized.store(true, std::memory_order_relaxed);
+}
+
+
+ProgressBar::ProgressBar(std::size_t total) : total(total), subtotal(0), term_winsize_s() {}
+
+void ProgressBar::watch_terminal() {
+  std::signal(SIGWINCH, on_resize);
+}
+
+// Only one thread draws at a time, so the cached size doesn't need a lock
 void ProgressBar::update_terminal_size() {
-  ioctl(0, TIOCGWINSZ, &term_winsize_s);
+  if (resized.exchange(false, std::memory_order_relaxed)) {
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &cached_winsize) != 0 or cached_winsize.ws_col == 0) {
+      cached_winsize.ws_col = 80;
+    }
+  }
+  term_winsize_s = cached_winsize;
 }
 
 // Set progress bar manually. Helpful for when you have to poll for updates and don't want to track the changes.
@@ -24,8 +47,10 @@ void ProgressBar::update(int amount) {
   subtotal += amount;
   update_terminal_size();
 
-  // 8 = 2 for the surrounding "|", and 6 for the width of the percentage
-  std::size_t columns = term_winsize_s.ws_col - (prefix.size() + suffix.size() + 8);
+  // 8 = 2 for the surrounding "|", and 6 for the width of the percentage. Nothing left for the bar on a narrow
+  // terminal, rather than a wrapped-around one.
+  std::size_t used = prefix.size() + suffix.size() + 8;
+  std::size_t columns = term_winsize_s.ws_col > used ? term_winsize_s.ws_col - used : 0;
 
   // Progress in terms of percentage (convert both to float first)
   double l = subtotal;
@@ -33,21 +58,27 @@ void ProgressBar::update(int amount) {
   double progress = 1;
 
   if (total > 0) {
-    progress = l / r;
+    progress = std::min(l / r, 1.0);
   }
 
   // How much to fill the bar
   std::size_t f = columns * progress;
   std::size_t uf = columns - f;
-  std::string filled(f, ' ');
-  std::string unfilled(uf, ' ');
 
   // Now make 'progress' a percentage
-  progress *= 100.0;
-
-  std::ostringstream oss;
-  oss << prefix << "|" << "\x1b[42m" << filled << "\x1b[00m" << unfilled << "|" << suffix << std::fixed << std::setprecision(1) << std::setw(5) << progress << "%";
-  bar = oss.str();
+  char percentage[16];
+  std::snprintf(percentage, sizeof(percentage), "%5.1f%%", progress * 100.0);
+
+  bar.clear();
+  bar.reserve(used + columns + 16);
+  bar += prefix;
+  bar += "|\x1b[42m";
+  bar.append(f, ' ');
+  bar += "\x1b[00m";
+  bar.append(uf, ' ');
+  bar += '|';
+  bar += suffix;
+  bar += percentage;
 }
 
 // Convenience member function for single updates.
@@ -72,3 +103,113 @@ void ProgressBar::set_prefix(const std::string& p) {
 void ProgressBar::set_suffix(const std::string& p) {
   suffix = p;
 }
+
+
+ProgressReporter::ProgressReporter(bool binary, std::chrono::milliseconds every) : binary(binary), every(every) {}
+
+ProgressReporter::~ProgressReporter() {
+  hide();
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
+
+void ProgressReporter::show(const std::string& label, std::function<Sample()> source) {
+  std::unique_lock<std::mutex> lock(mutex);
+  sample = std::move(source);
+  text = nullptr;
+  bar.set_prefix(label);
+  bar.set_suffix(" ");
+  rate = 0;
+  last_bytes = 0;
+  last_time = std::chrono::steady_clock::now();
+  shown = true;
+  if (!thread.joinable()) {
+    thread = std::thread(&ProgressReporter::run, this);
+  }
+  draw();
+}
+
+void ProgressReporter::show(std::function<std::string()> source) {
+  std::unique_lock<std::mutex> lock(mutex);
+  sample = nullptr;
+  text = std::move(source);
+  shown = true;
+  if (!thread.joinable()) {
+    thread = std::thread(&ProgressReporter::run, this);
+  }
+  draw();
+}
+
+void ProgressReporter::hide() {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (!shown) {
+    return;
+  }
+  // One last time, so a bar ends up full
+  draw();
+  shown = false;
+  sample = nullptr;
+  text = nullptr;
+  std::cout << "\x1b[2K\x1b[u\x1b[2K";
+  std::cout.flush();
+}
+
+void ProgressReporter::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!stopping) {
+    wake.wait_for(lock, every, [this] { return stopping; });
+    if (shown and !stopping) {
+      draw();
+    }
+  }
+}
+
+// Call with `mutex` held
+void ProgressReporter::draw() {
+  if (text) {
+    std::cout << text() << "\x1b[u";
+    std::cout.flush();
+    return;
+  }
+  if (!sample) {
+    return;
+  }
+
+  Sample now = sample();
+  auto time = std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(time - last_time).count();
+  if (seconds > 0 and now.bytes >= last_bytes) {
+    double current = (now.bytes - last_bytes) / seconds;
+    // Smoothed, so the ETA doesn't jump around with every read
+    rate = rate == 0 ? current : rate * 0.8 + current * 0.2;
+  }
+  last_bytes = now.bytes;
+  last_time = time;
+
+  std::string suffix = " ";
+  if (now.bytes_total > 0) {
+    suffix += fsize(static_cast<std::size_t>(rate), binary) + "/s ";
+    if (now.bytes < now.bytes_total and rate > 0) {
+      auto left = static_cast<std::uint64_t>((now.bytes_total - now.bytes) / rate);
+      char eta[32];
+      if (left >= 3600) {
+        std::snprintf(eta, sizeof(eta), "ETA %llu:%02llu:%02llu ", static_cast<unsigned long long>(left / 3600), static_cast<unsigned long long>(left / 60 % 60), static_cast<unsigned long long>(left % 60));
+      }
+      else {
+        std::snprintf(eta, sizeof(eta), "ETA %llu:%02llu ", static_cast<unsigned long long>(left / 60), static_cast<unsigned long long>(left % 60));
+      }
+      suffix += eta;
+    }
+  }
+  bar.set_suffix(suffix);
+  bar.total = now.total;
+  bar.set_progress(now.done);
+  std::cout << bar.bar << "\x1b[u";
+  std::cout.flush();
+}
@@ -0,0 +1,181 @@
+#include "replace.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <thread>
+#include <unistd.h>
+
+
+// How much one FIDEDUPERANGE call is asked to share. The kernel caps a single call anyway (16 MiB on most
+// filesystems), and going in steps keeps a huge file from holding its locks for ages.
+static constexpr std::size_t dedupe_chunk = 16 * 1024 * 1024;
+
+
+Replacer::Replacer(std::size_t threads, ReplaceMode mode, const PathTable& paths) : mode(mode), paths(paths) {
+  std::size_t upper = std::thread::hardware_concurrency();
+  max_workers = std::max<std::size_t>(std::min(threads, upper), 1);
+  char buffer[PATH_MAX];
+  if (getcwd(buffer, sizeof(buffer)) != nullptr) {
+    cwd = buffer;
+  }
+}
+
+// Jobs are handed out a directory at a time, in the order they came in otherwise.
+auto Replacer::run(std::vector<Replacement>& jobs, const std::function<void(std::size_t)>& progress) -> void {
+  std::vector<std::size_t> order(jobs.size());
+  for (std::size_t ix = 0; ix < order.size(); ++ix) {
+    order[ix] = ix;
+  }
+  std::stable_sort(order.begin(), order.end(), [&jobs](std::size_t left, std::size_t right) {
+    return jobs[left].target.dir < jobs[right].target.dir;
+  });
+
+  // (begin, end) into `order`, one per directory
+  std::vector<std::pair<std::size_t, std::size_t>> dirs;
+  for (std::size_t ix = 0; ix < order.size(); ++ix) {
+    if (ix == 0 or jobs[order[ix]].target.dir != jobs[order[ix - 1]].target.dir) {
+      dirs.emplace_back(ix, ix);
+    }
+    dirs.back().second = ix + 1;
+  }
+
+  done = 0;
+  std::atomic<std::size_t> next = 0;
+
+  auto work = [&]() {
+    DirHandles handles(paths, 4);
+    for (std::size_t ix = next++; ix < dirs.size(); ix = next++) {
+      for (std::size_t job = dirs[ix].first; job < dirs[ix].second; ++job) {
+        replace(jobs[order[job]], handles);
+        done.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (std::size_t ix = 0; ix < std::min(max_workers, dirs.size()); ++ix) {
+    threads.emplace_back(work);
+  }
+  if (progress) {
+    while (done.load(std::memory_order_relaxed) < jobs.size()) {
+      progress(done.load(std::memory_order_relaxed));
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    progress(jobs.size());
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+auto Replacer::replace(Replacement& job, DirHandles& handles) -> void {
+  if (mode == ReplaceMode::reflink) {
+    dedupe(job, handles);
+  }
+  else {
+    link(job, handles);
+  }
+}
+
+// Make the link under a name nobody else uses, then rename it over the duplicate. rename() swaps the name over in one
+// go, so the path always points at either the old file or the new link.
+auto Replacer::link(Replacement& job, DirHandles& handles) -> void {
+  std::string tmp = ".xdupes-" + std::to_string(getpid()) + "-" + std::to_string(temporaries++) + ".tmp";
+  std::string name = paths.name(job.target);
+
+  int at = handles.dir(job.target.dir);
+  if (at < 0) {
+    std::string dir = paths.dir_path(job.target.dir);
+    tmp = dir + '/' + tmp;
+    name = dir + '/' + name;
+    at = AT_FDCWD;
+  }
+
+  int status;
+  if (mode == ReplaceMode::symlink) {
+    std::string target = job.kept.front() == '/' or cwd.empty() ? job.kept : cwd + '/' + job.kept;
+    status = symlinkat(target.c_str(), at, tmp.c_str());
+  }
+  else {
+    status = linkat(AT_FDCWD, job.kept.c_str(), at, tmp.c_str(), 0);
+  }
+  if (status != 0) {
+    job.outcome = Replacement::Outcome::failed;
+    job.error = errno;
+    return;
+  }
+
+  if (renameat(at, tmp.c_str(), at, name.c_str()) != 0) {
+    job.outcome = Replacement::Outcome::failed;
+    job.error = errno;
+    unlinkat(at, tmp.c_str(), 0);
+    return;
+  }
+  job.outcome = Replacement::Outcome::done;
+}
+
+// The duplicate keeps its name, inode and metadata, and only its data blocks get swapped for the kept file's. The
+// kernel locks both files and compares them itself before sharing anything, so a file that changed since it was
+// hashed comes back as different rather than getting clobbered.
+auto Replacer::dedupe(Replacement& job, DirHandles& handles) -> void {
+  job.outcome = Replacement::Outcome::failed;
+
+  int source = ::open(job.kept.c_str(), O_RDONLY | O_CLOEXEC);
+  if (source < 0) {
+    job.error = errno;
+    return;
+  }
+  // Read-only is enough for a file we own (since Linux 4.19), and leaves its mtime alone
+  int dest = handles.open(job.target, O_RDONLY | O_CLOEXEC);
+  if (dest < 0) {
+    job.error = errno;
+    close(source);
+    return;
+  }
+
+  std::vector<char> buffer(sizeof(file_dedupe_range) + sizeof(file_dedupe_range_info));
+  auto* range = reinterpret_cast<file_dedupe_range*>(buffer.data());
+  range->dest_count = 1;
+  range->info[0].dest_fd = dest;
+
+  std::size_t offset = 0;
+  job.outcome = Replacement::Outcome::done;
+  while (offset < job.size) {
+    range->src_offset = offset;
+    range->src_length = std::min(dedupe_chunk, job.size - offset);
+    range->info[0].dest_offset = offset;
+    range->info[0].bytes_deduped = 0;
+    range->info[0].status = 0;
+
+    int error = 0;
+    if (ioctl(source, FIDEDUPERANGE, range) != 0) {
+      error = errno;
+    }
+    else if (range->info[0].status < 0) {
+      error = -range->info[0].status;
+    }
+    else if (range->info[0].status == FILE_DEDUPE_RANGE_DIFFERS) {
+      job.outcome = Replacement::Outcome::differs;
+      break;
+    }
+    else if (range->info[0].bytes_deduped == 0) {
+      error = EIO;
+    }
+
+    if (error != 0) {
+      bool unsupported = error == EOPNOTSUPP or error == ENOTTY or error == EINVAL or error == EXDEV;
+      job.outcome = unsupported ? Replacement::Outcome::unsupported : Replacement::Outcome::failed;
+      job.error = error;
+      break;
+    }
+    offset += range->info[0].bytes_deduped;
+  }
+
+  close(dest);
+  close(source);
+}
@@ -0,0 +1,108 @@
+#include "results.hpp"
+
+#include <limits>
+
+
+// One shard per thread that files results. Only call this while nothing is being filed.
+auto ResultTable::resize(std::size_t count) -> void {
+  shards = std::vector<Shard>(count);
+}
+
+// Each shard must only ever be touched by one thread at a time.
+auto ResultTable::add(std::size_t shard, std::size_t group, XXH128_hash_t hash, std::size_t index) -> void {
+  shards.at(shard).records.push_back({group, hash.low64, hash.high64, index});
+}
+
+auto ResultTable::merge() -> void {
+  std::size_t total = 0;
+  for (const auto& shard : shards) {
+    total += shard.records.size();
+  }
+
+  // Twice as many slots as records keeps the probe sequences short. 32-bit key ids are plenty for one stage.
+  constexpr std::uint32_t empty = std::numeric_limits<std::uint32_t>::max();
+  std::size_t capacity = 2;
+  while (capacity < total * 2) {
+    capacity <<= 1;
+  }
+  std::size_t mask = capacity - 1;
+  std::vector<std::uint32_t> slots(capacity, empty);
+
+  // The first record seen for each key, and how many records share it
+  std::vector<const Result*> keys;
+  std::vector<std::uint32_t> key_of;
+  key_of.reserve(total);
+  offsets.clear();
+
+  for (const auto& shard : shards) {
+    for (const auto& record : shard.records) {
+      // The digest is already well mixed, so only the group needs stirring in
+      std::size_t slot = (record.low ^ (record.group * 0x9E3779B97F4A7C15ULL)) & mask;
+      while (true) {
+        std::uint32_t key = slots[slot];
+        if (key == empty) {
+          key = static_cast<std::uint32_t>(keys.size());
+          slots[slot] = key;
+          keys.push_back(&record);
+          offsets.push_back(0);
+          key_of.push_back(key);
+          offsets[key]++;
+          break;
+        }
+        const Result* other = keys[key];
+        if (other->low == record.low and other->high == record.high and other->group == record.group) {
+          key_of.push_back(key);
+          offsets[key]++;
+          break;
+        }
+        slot = (slot + 1) & mask;
+      }
+    }
+  }
+
+  // Turn the counts into starting offsets, then drop every task index into its key's range
+  std::size_t running = 0;
+  for (auto& offset : offsets) {
+    std::size_t count = offset;
+    offset = running;
+    running += count;
+  }
+  offsets.push_back(running);
+
+  digests.clear();
+  digests.reserve(keys.size());
+  for (const Result* key : keys) {
+    digests.push_back({key->low, key->high});
+  }
+
+  std::vector<std::size_t> cursor(offsets.begin(), offsets.end() - 1);
+  indices.resize(total);
+  std::size_t ix = 0;
+  for (auto& shard : shards) {
+    for (const auto& record : shard.records) {
+      indices[cursor[key_of[ix++]]++] = record.index;
+    }
+    shard.records.clear();
+  }
+}
+
+auto ResultTable::clear() -> void {
+  for (auto& shard : shards) {
+    shard.records.clear();
+  }
+  indices.clear();
+  offsets.clear();
+  digests.clear();
+}
+
+auto ResultTable::size() const -> std::size_t {
+  return offsets.empty() ? 0 : offsets.size() - 1;
+}
+
+auto ResultTable::members(std::size_t key) const -> Members {
+  return {indices.data() + offsets[key], indices.data() + offsets[key + 1]};
+}
+
+auto ResultTable::digest(std::size_t key) const -> XXH128_hash_t {
+  return digests[key];
+}
@@ -1,106 +1,779 @@
 #include "threadpool.hpp"
+#include "cache.hpp"
+#include "hasher.hpp"
+#include "layout.hpp"
+#include "mapped.hpp"
+#include "uring.hpp"
+#include "utils.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
 
 
 // Manager for threads. Loops N threads. Each thread pulls tasks from the queue.
-ThreadPool::ThreadPool(std::size_t threads) : max_workers(threads) {}
+ThreadPool::ThreadPool(std::size_t threads) : max_workers(threads), logger(logging::get_logger("xdupes")) {}
 
 auto ThreadPool::start() -> void {
   std::size_t upper = std::thread::hardware_concurrency();
   max_workers = std::min(std::max<std::size_t>(max_workers, 0), upper);
   if (max_workers == 0) {
-    max_workers = upper / 2;
+    max_workers = std::max<std::size_t>(upper / 2, 1);
+  }
+  // Workers mostly wait on reads, so the tuner gets to go well past the number of cores
+  if (autotune) {
+    max_workers = std::max<std::size_t>(upper * 2, 16);
   }
+  active_workers = autotune ? std::min<std::size_t>(4, max_workers) : max_workers;
+  windows_at = std::vector<std::size_t>(max_workers + 1);
 
   if (!threads.empty()) {
     throw std::logic_error("ThreadPool::start() on an active ThreadLoop instance");
   }
+  if (mmap_threshold > 0) {
+    install_sigbus_handler();
+  }
+  for (const auto& [dev, limit] : devices) {
+    lanes.emplace_back(new Lane(dev, limit));
+  }
+  lanes.emplace_back(new Lane(0, 0));
+  worker_counters = std::vector<ThreadCounters>(max_workers);
+  // One shard per worker, plus one for whoever calls record()
+  results.resize(max_workers + 1);
   for (std::size_t ix = 0; ix < max_workers; ix++) {
-    threads.emplace_back(&ThreadPool::loop, this);
+    threads.emplace_back(engine == IoEngine::uring ? &ThreadPool::loop_uring : &ThreadPool::loop, this, ix);
+  }
+  if (autotune) {
+    tuner = std::thread(&ThreadPool::tune, this);
   }
 }
 
-auto ThreadPool::loop() -> void {
-  XXH3_state_t* const state = XXH3_createState();
-  if (state == nullptr) {
-    abort();
-  }
-  std::ifstream ifs;
+auto ThreadPool::loop(std::size_t worker) -> void {
   std::array<char, 1048576> buffer;
-  XXH128_hash_t hash;
+  Hashers hashers;
+  ThreadCounters& counters = worker_counters.at(worker);
+  DirHandles handles(*paths);
 
-  while (true) {
-    std::string task;
-    if (XXH3_128bits_reset(state) == XXH_ERROR) {
+  std::size_t ix;
+  while (next(worker, ix, true)) {
+    if (ix & segment_flag) {
+      auto [hash, complete] = hash_segment(hashers.xxh3_128, ix & ~segment_flag, buffer.data(), buffer.size(), counters, handles);
+      finish_segment(worker, ix & ~segment_flag, hash, complete);
+      continue;
+    }
+    Task& task = table[ix];
+    auto [hash, complete] = hashers.visit(hash_of(task), [&](auto& hasher) {
+      return hash_file(hasher, task, buffer.data(), buffer.size(), counters, handles);
+    });
+    // Don't cache anything from a file that came up short
+    finish(worker, ix, hash, complete);
+  }
+}
+
+// Read whatever the current stage wants of one file into `hasher`. Returns the digest, and whether every byte that
+// should have been read was.
+template <class Hasher>
+auto ThreadPool::hash_file(Hasher& hasher, Task& task, char* buffer, std::size_t buffer_size, ThreadCounters& counters, DirHandles& handles) -> std::pair<XXH128_hash_t, bool> {
+  hasher.reset();
+  if (stage_of(task) == Stage::sample) {
+    hasher.update(&task.size, sizeof(task.size));
+  }
+
+  int fd = handles.open(task.path, O_RDONLY | O_CLOEXEC);
+  counters.add(Counter::opens);
+  if (fd < 0) {
+    return {hasher.digest(), false};
+  }
+  if (locating and task.location == 0) {
+    task.location = locate(fd, task.key.ino);
+  }
+
+  bool complete = true;
+  for (std::size_t part = 0; complete and part < parts(task); ++part) {
+    auto [offset, length] = range(task, part);
+    complete = read_range(hasher, fd, offset, length, buffer, buffer_size, counters);
+  }
+  close(fd);
+
+  return {hasher.digest(), complete};
+}
+
+// One segment of a chunked file, always with XXH3-128
+auto ThreadPool::hash_segment(Xxh3_128& hasher, std::size_t ix, char* buffer, std::size_t buffer_size, ThreadCounters& counters, DirHandles& handles) -> std::pair<XXH128_hash_t, bool> {
+  const Segment& segment = segments[ix];
+  const Task& task = table[segment.file->task];
+  hasher.reset();
+
+  int fd = handles.open(task.path, O_RDONLY | O_CLOEXEC);
+  counters.add(Counter::opens);
+  if (fd < 0) {
+    return {hasher.digest(), false};
+  }
+  std::size_t offset = segment.number * chunk_segment;
+  bool complete = read_range(hasher, fd, offset, std::min(chunk_segment, task.size - offset), buffer, buffer_size, counters);
+  close(fd);
+
+  return {hasher.digest(), complete};
+}
+
+// Feed `length` bytes at `offset` into `hasher`. Returns whether all of them were there to read.
+template <class Hasher>
+auto ThreadPool::read_range(Hasher& hasher, int fd, std::size_t offset, std::size_t length, char* buffer, std::size_t buffer_size, ThreadCounters& counters) -> bool {
+  // Big enough to be worth skipping the copy into `buffer`. Files that can't be mapped at all get read like the rest.
+  if (mmap_threshold > 0 and length >= mmap_threshold) {
+    Mapped mapped = hash_mapped(fd, offset, length, hasher);
+    if (mapped == Mapped::complete) {
+      counters.add(Counter::bytes, length);
+    }
+    if (mapped != Mapped::unmapped) {
+      return mapped == Mapped::complete;
+    }
+  }
+
+  while (length > 0) {
+    ssize_t got = pread(fd, buffer, std::min(length, buffer_size), offset);
+    counters.add(Counter::reads);
+    if (got <= 0) {
+      break;
+    }
+    hasher.update(buffer, got);
+    counters.add(Counter::bytes, got);
+    offset += got;
+    length -= got;
+  }
+  return length == 0;
+}
+
+// Same job as loop(), but each worker keeps up to `queue_depth` files open, with one read in flight for each of them.
+// Reads within a file still complete in order, since the next one is only queued once the last one has been hashed.
+auto ThreadPool::loop_uring(std::size_t worker) -> void {
+  Ring ring;
+  if (!ring.init(queue_depth)) {
+    loop(worker);
+    return;
+  }
+
+  struct Slot {
+    std::size_t index;
+    int fd = -1;
+    // Which of `hashers` this file is going into
+    HashKind kind = HashKind::xxh3_128;
+    std::unique_ptr<Hashers> hashers;
+    std::vector<char> buffer;
+    iovec iov;
+    std::size_t offset = 0;
+    std::size_t remaining = 0;
+    std::size_t part = 0;
+  };
+
+  std::vector<Slot> slots(queue_depth);
+  std::vector<std::size_t> free_slots;
+  for (std::size_t ix = 0; ix < queue_depth; ++ix) {
+    slots.at(ix).hashers = std::make_unique<Hashers>();
+    slots.at(ix).buffer.resize(1048576);
+    free_slots.push_back(ix);
+  }
+
+  ThreadCounters& counters = worker_counters.at(worker);
+  DirHandles handles(*paths);
+
+  auto queue_read = [&](std::size_t ix) {
+    Slot& slot = slots.at(ix);
+    counters.add(Counter::reads);
+    slot.iov.iov_base = slot.buffer.data();
+    slot.iov.iov_len = std::min(slot.remaining, slot.buffer.size());
+    if (!ring.prepare_read(slot.fd, &slot.iov, slot.offset, ix)) {
       abort();
     }
+  };
 
-    {
-      std::unique_lock<std::mutex> lock(tasks_mutex);
-      condition.wait(lock, [this] { return !tasks.empty() || should_terminate; });
-      if (should_terminate) {
-        // Still need to free the hash's state
+  auto close_slot = [&](std::size_t ix, bool complete) {
+    Slot& slot = slots.at(ix);
+    if (slot.fd >= 0) {
+      close(slot.fd);
+      slot.fd = -1;
+    }
+    XXH128_hash_t hash = slot.hashers->visit(slot.kind, [](auto& hasher) { return hasher.digest(); });
+    if (slot.index & segment_flag) {
+      finish_segment(worker, slot.index & ~segment_flag, hash, complete);
+    }
+    else {
+      finish(worker, slot.index, hash, complete);
+    }
+    free_slots.push_back(ix);
+  };
+
+  std::size_t in_flight = 0;
+
+  while (true) {
+    // Top up the free slots. Only block for more work when there is nothing left to wait on.
+    bool terminate = false;
+    while (!free_slots.empty()) {
+      std::size_t ix = free_slots.back();
+      Slot& slot = slots.at(ix);
+      if (!next(worker, slot.index, in_flight == 0)) {
+        terminate = in_flight == 0;
         break;
       }
-      task = tasks.front();
-      tasks.pop();
-    }
+      free_slots.pop_back();
 
-    ifs = std::ifstream(task, std::ios_base::binary);
-    if (ifs.is_open()) {
-      while (ifs.good()) {
-        ifs.read(buffer.data(), 1048576);
-        if (XXH3_128bits_update(state, buffer.data(), ifs.gcount()) == XXH_ERROR) {
-          abort();
+      // A segment is one range of its file, hashed like any other, just finished differently
+      bool segment = slot.index & segment_flag;
+      const Task& task = table[segment ? segments[slot.index & ~segment_flag].file->task : slot.index];
+      slot.kind = segment ? HashKind::xxh3_128 : hash_of(task);
+      slot.hashers->visit(slot.kind, [&](auto& hasher) {
+        hasher.reset();
+        if (!segment and stage_of(task) == Stage::sample) {
+          hasher.update(&task.size, sizeof(task.size));
         }
+      });
+      slot.part = 0;
+      if (segment) {
+        slot.offset = segments[slot.index & ~segment_flag].number * chunk_segment;
+        slot.remaining = std::min(chunk_segment, task.size - slot.offset);
+      }
+      else {
+        std::tie(slot.offset, slot.remaining) = range(task, 0);
+      }
+
+      slot.fd = handles.open(task.path, O_RDONLY | O_CLOEXEC);
+      counters.add(Counter::opens);
+      if (locating and !segment and slot.fd >= 0 and task.location == 0) {
+        table[slot.index].location = locate(slot.fd, task.key.ino);
+      }
+      if (slot.fd < 0 or slot.remaining == 0) {
+        close_slot(ix, slot.fd >= 0);
+        continue;
       }
-      ifs.close();
+      queue_read(ix);
+      in_flight++;
     }
 
-    hash = XXH3_128bits_digest(state);
-    {
-      std::unique_lock<std::mutex> lock(results_mutex);
-      results[hash.low64][hash.high64].emplace_back(task);
+    if (terminate) {
+      break;
+    }
+    if (in_flight == 0) {
+      continue;
+    }
+
+    if (!ring.submit_and_wait(1)) {
+      abort();
     }
+
+    std::uint64_t ix;
+    std::int32_t res;
+    while (ring.peek(ix, res)) {
+      Slot& slot = slots.at(ix);
+      if (res > 0) {
+        slot.hashers->visit(slot.kind, [&](auto& hasher) { hasher.update(slot.buffer.data(), res); });
+        slot.offset += res;
+        slot.remaining -= res;
+        counters.add(Counter::bytes, res);
+      }
+      // On to the next sampled block, if there is one
+      if (res > 0 and slot.remaining == 0 and !(slot.index & segment_flag) and slot.part + 1 < parts(table[slot.index])) {
+        std::tie(slot.offset, slot.remaining) = range(table[slot.index], ++slot.part);
+      }
+      // Errors and early EOFs finish the file with whatever was read, same as loop()
+      if (res <= 0 or slot.remaining == 0) {
+        close_slot(ix, slot.remaining == 0);
+        in_flight--;
+        continue;
+      }
+      queue_read(ix);
+    }
+  }
+}
+
+// Pop the next task's index from any device that is under its limit. Workers start looking at different lanes, so
+// they spread out over the devices. Blocks until there is something to take if `wait` is set. Returns false when there
+// is nothing to do right now, or when the pool is shutting down.
+auto ThreadPool::next(std::size_t worker, std::size_t& ix, bool wait) -> bool {
+  while (true) {
+    // Tuned out. Whatever this worker still has in flight gets finished, but it takes nothing new.
+    if (worker >= active_workers.load()) {
+      if (should_terminate.load() or !wait) {
+        return false;
+      }
+      worker_counters.at(worker).idle_begin();
+      {
+        std::unique_lock<std::mutex> lock(idle_mutex);
+        parked.wait(lock, [this, worker] { return worker < active_workers.load() || should_terminate.load(); });
+      }
+      worker_counters.at(worker).idle_end();
+      continue;
+    }
+    for (std::size_t offset = 0; offset < lanes.size(); ++offset) {
+      Lane& candidate = *lanes.at((worker + offset) % lanes.size());
+      if (!claim(candidate)) {
+        continue;
+      }
+      if (candidate.tasks.try_pop(ix)) {
+        return true;
+      }
+      release(candidate);
+    }
+    if (should_terminate.load() or !wait) {
+      return false;
+    }
+    // Announce ourselves before the last look at the lanes, so that enqueue() and release() can't miss us
+    sleepers.fetch_add(1);
+    worker_counters.at(worker).idle_begin();
     {
-      std::unique_lock<std::mutex> lock(total_mutex);
-      total_done++;
+      std::unique_lock<std::mutex> lock(idle_mutex);
+      // Waking up tuned out is fine too, since then it goes and parks. That way, everyone asleep here may take work,
+      // and notify_one() can't be wasted on a worker that isn't allowed to.
+      condition.wait(lock, [this, worker] { return ready() || should_terminate.load() || worker >= active_workers.load(); });
     }
+    worker_counters.at(worker).idle_end();
+    sleepers.fetch_sub(1);
   }
+}
 
-  XXH3_freeState(state);
+// Whether some lane has work queued and room for another reader
+auto ThreadPool::ready() -> bool {
+  for (const auto& candidate : lanes) {
+    if (!candidate->tasks.empty() and (candidate->limit == 0 or candidate->active.load() < candidate->limit)) {
+      return true;
+    }
+  }
+  return false;
 }
 
-auto ThreadPool::enqueue(const std::string& path) -> void {
-  {
-    std::unique_lock<std::mutex> lock(tasks_mutex);
-    tasks.push(path);
+// Take one of a lane's reader slots, if it has any left.
+auto ThreadPool::claim(Lane& candidate) -> bool {
+  std::size_t active = candidate.active.load();
+  do {
+    if (candidate.limit != 0 and active >= candidate.limit) {
+      return false;
+    }
+  } while (!candidate.active.compare_exchange_weak(active, active + 1));
+  return true;
+}
+
+// Give a reader slot back. Someone may have gone to sleep because the lane was full, so wake them.
+auto ThreadPool::release(Lane& candidate) -> void {
+  candidate.active.fetch_sub(1);
+  if (candidate.limit != 0 and sleepers.load() > 0) {
+    std::unique_lock<std::mutex> lock(idle_mutex);
+    condition.notify_one();
   }
-  condition.notify_one();
 }
 
-auto ThreadPool::busy() -> bool {
-  bool poolbusy;
+// The lane a device's files are queued in. There are only ever a handful, so a scan is fine.
+auto ThreadPool::lane(std::uint64_t dev) -> Lane& {
+  for (std::size_t ix = 0; ix + 1 < lanes.size(); ++ix) {
+    if (lanes[ix]->dev == dev) {
+      return *lanes[ix];
+    }
+  }
+  return *lanes.back();
+}
+
+// The stage a task really gets hashed as. Sampling a file that's small (or not much bigger than the samples) saves
+// next to nothing, so those are read whole, and their digest is every bit as good as the full stage's.
+auto ThreadPool::stage_of(const Task& task) const -> Stage {
+  if (stage == Stage::sample and (task.size < sample_threshold or task.size <= sample_blocks * block_size)) {
+    return Stage::full;
+  }
+  // A probe that takes in the whole file is a full hash, and gets the full hash's hasher
+  if ((stage == Stage::head or stage == Stage::tail) and task.size <= block_size) {
+    return Stage::full;
+  }
+  return stage;
+}
+
+auto ThreadPool::hash_of(const Task& task) const -> HashKind {
+  Stage as = stage_of(task);
+  return as == Stage::head or as == Stage::tail ? probe_hash : HashKind::xxh3_128;
+}
+
+// Only call this while the pool is idle
+auto ThreadPool::set_probe_hash(HashKind kind) -> void {
+  probe_hash = kind;
+}
+
+// How many separate ranges of a file the current stage reads
+auto ThreadPool::parts(const Task& task) const -> std::size_t {
+  return stage_of(task) == Stage::sample ? sample_blocks : 1;
+}
+
+// Work out which bytes of a file the current stage cares about, as (offset, length). Samples are spread evenly from
+// the very start to the very end, so every file of a given size gets sampled at the same offsets.
+auto ThreadPool::range(const Task& task, std::size_t part) const -> std::pair<std::size_t, std::size_t> {
+  std::size_t offset = 0;
+  std::size_t length = task.size;
+  switch (stage_of(task)) {
+    case Stage::head:
+      length = std::min(block_size, task.size);
+      break;
+    case Stage::tail:
+      length = std::min(block_size, task.size);
+      offset = task.size - length;
+      break;
+    case Stage::sample:
+      length = block_size;
+      offset = sample_blocks < 2 ? 0 : (task.size - block_size) / (sample_blocks - 1) * part;
+      break;
+    case Stage::full:
+      break;
+  }
+  return {offset, length};
+}
+
+// Hand a finished digest over, and free up its reader slot.
+auto ThreadPool::finish(std::size_t worker, std::size_t ix, XXH128_hash_t hash, bool complete) -> void {
+  release(lane(table[ix].key.dev));
+  deliver(worker, ix, hash, complete);
+}
+
+// Every segment gets a reader slot of its own. The last one to finish puts the file's digest together: the segment
+// digests are hashed in pairs, level by level (an odd one out goes up as it is), and the root gets hashed once more
+// along with the file's size. The tree's shape only depends on the size, so neither the number of workers nor the
+// order the segments finish in makes any difference.
+auto ThreadPool::finish_segment(std::size_t worker, std::size_t ix, XXH128_hash_t hash, bool complete) -> void {
+  ChunkedFile& file = *segments[ix].file;
+  file.digests.at(segments[ix].number) = hash;
+  if (!complete) {
+    file.complete = false;
+  }
+  const Task& task = table[file.task];
+  release(lane(task.key.dev));
+  if (file.remaining.fetch_sub(1) != 1) {
+    return;
+  }
+  // One short segment spoils the whole file, same as a short read would have
+  if (!file.complete.load()) {
+    deliver(worker, file.task, {0, 0}, false);
+    return;
+  }
+
+  // Canonical (big endian, high half first) so that the digest is the same on every host
+  auto canonical = [](const XXH128_hash_t& digest, unsigned char* out) {
+    for (std::size_t ix = 0; ix < 8; ++ix) {
+      out[ix] = static_cast<unsigned char>(digest.high64 >> (56 - ix * 8));
+      out[8 + ix] = static_cast<unsigned char>(digest.low64 >> (56 - ix * 8));
+    }
+  };
+
+  Xxh3_128 hasher;
+  unsigned char pair[32];
+  std::vector<XXH128_hash_t>& level = file.digests;
+  while (level.size() > 1) {
+    std::size_t parents = 0;
+    for (std::size_t child = 0; child < level.size(); child += 2) {
+      if (child + 1 == level.size()) {
+        level[parents++] = level[child];
+        continue;
+      }
+      canonical(level[child], pair);
+      canonical(level[child + 1], pair + 16);
+      hasher.reset();
+      hasher.update(pair, sizeof(pair));
+      level[parents++] = hasher.digest();
+    }
+    level.resize(parents);
+  }
+  canonical(level.at(0), pair);
+  std::uint64_t size = task.size;
+  for (std::size_t ix = 0; ix < 8; ++ix) {
+    pair[16 + ix] = static_cast<unsigned char>(size >> (56 - ix * 8));
+  }
+  hasher.reset();
+  hasher.update(pair, 24);
+
+  deliver(worker, file.task, hasher.digest(), true);
+}
+
+// File a finished digest in the results (and the cache). A file that couldn't be read in full (it couldn't be opened,
+// came up short, or got truncated under a mapping) is left out of the results altogether. Its digest only covers
+// whatever was read, so two of them of the same size would otherwise look like duplicates of each other.
+auto ThreadPool::deliver(std::size_t worker, std::size_t ix, XXH128_hash_t hash, bool complete) -> void {
+  if (complete) {
+    if (cache != nullptr) {
+      cache->store(table[ix], stage_of(table[ix]), block_size, hash);
+    }
+    file(worker, ix, hash);
+  }
+  else {
+    logger.warn("could not read all of " + repr(paths->path(table[ix].path)) + ", skipping it");
+    finished.fetch_add(1, std::memory_order_relaxed);
+  }
+  worker_counters.at(worker).add(Counter::files);
+  if (pending.fetch_sub(1) == 1) {
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done.notify_all();
+  }
+}
+
+// Set this before start(). Only the sync engine uses it, since a page fault would stall every read in a ring.
+auto ThreadPool::set_mmap_threshold(std::size_t threshold) -> void {
+  mmap_threshold = threshold;
+}
+
+// Sample `blocks` blocks (of the sample stage's block size) from every file at least `threshold` bytes long. Only
+// change this while the pool is idle.
+auto ThreadPool::set_sampling(std::size_t blocks, std::size_t threshold) -> void {
+  sample_blocks = std::max<std::size_t>(blocks, 1);
+  sample_threshold = threshold;
+}
+
+// Pick how the workers read files. Set this before start().
+auto ThreadPool::set_io(IoEngine e, std::size_t depth) -> void {
+  engine = e;
+  queue_depth = std::max<std::size_t>(depth, 1);
+}
+
+// Per-device limits on how many files may be read at once, as (st_dev, limit), with 0 meaning no limit. Devices that
+// aren't listed share one unlimited queue. Set this before start().
+auto ThreadPool::set_devices(const std::vector<std::pair<std::uint64_t, std::size_t>>& limits) -> void {
+  devices = limits;
+}
+
+// The table every task's path points into. Set this before start().
+auto ThreadPool::set_paths(const PathTable* p) -> void {
+  paths = p;
+}
+
+// Digests get stored in the cache as they are computed. Set this before start().
+auto ThreadPool::set_cache(HashCache* c) -> void {
+  cache = c;
+}
+
+// File a digest in a shard of the results. Each shard belongs to exactly one thread, so this takes no lock.
+auto ThreadPool::file(std::size_t shard, std::size_t ix, XXH128_hash_t hash) -> void {
+  results.add(shard, table[ix].group, hash, ix);
+  finished.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Add a task whose digest is already known (from the cache, say), without bothering the workers. Returns its index.
+auto ThreadPool::record(Task task, XXH128_hash_t hash) -> std::size_t {
+  std::size_t ix = table.push(std::move(task));
+  file(max_workers, ix, hash);
+  return ix;
+}
+
+// Only call this while the pool is idle (before enqueueing, or after join()).
+auto ThreadPool::set_stage(Stage s, std::size_t block) -> void {
+  stage = s;
+  block_size = block;
+  std::unique_lock<std::mutex> lock(tune_mutex);
+  std::fill(windows_at.begin(), windows_at.end(), 0);
+}
+
+// Let the pool pick its own number of workers while it runs. Set this before start().
+auto ThreadPool::set_autotune(bool on) -> void {
+  autotune = on;
+}
+
+// The worker count this stage spent the most time at so far, as its steady state (the smaller one on a tie). Just the
+// worker count without --threads auto.
+auto ThreadPool::tuned() -> std::size_t {
+  std::unique_lock<std::mutex> lock(tune_mutex);
+  std::size_t best = active_workers.load();
+  std::size_t most = 0;
+  for (std::size_t count = 1; count < windows_at.size(); ++count) {
+    if (windows_at[count] > most) {
+      best = count;
+      most = windows_at[count];
+    }
+  }
+  return best;
+}
+
+// Bytes the workers have read so far, over every stage
+auto ThreadPool::bytes_read() const -> std::uint64_t {
+  std::uint64_t total = 0;
+  for (const auto& counters : worker_counters) {
+    total += counters.values[static_cast<std::size_t>(Counter::bytes)].load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+auto ThreadPool::resize(std::size_t count) -> void {
   {
-    std::unique_lock<std::mutex> lock(tasks_mutex);
-    poolbusy = !tasks.empty();
+    std::unique_lock<std::mutex> lock(idle_mutex);
+    active_workers = count;
   }
-  return poolbusy;
+  // Sleepers that are now tuned out have to move over to `parked`, and parked workers that are back in have to wake
+  condition.notify_all();
+  parked.notify_all();
+}
+
+// Hill climbing on bytes read per window. Every window, the worker count takes a step. If throughput went up, it keeps
+// going the same way with twice the step. If it went down, it turns around. If it hardly changed, the extra workers
+// weren't worth having, so it heads down. It ends up going back and forth around the best count, which tuned()
+// reports.
+auto ThreadPool::tune() -> void {
+  constexpr auto window = std::chrono::milliseconds(250);
+  // Changes smaller than this are taken for noise
+  constexpr double margin = 0.05;
+  constexpr std::size_t max_step = 8;
+
+  std::uint64_t last_bytes = bytes_read();
+  double last_rate = 0;
+  bool growing = true;
+  std::size_t step = 1;
+  bool was_busy = false;
+
+  std::unique_lock<std::mutex> lock(tune_mutex);
+  while (!tune_wake.wait_for(lock, window, [this] { return should_terminate.load(); })) {
+    std::uint64_t bytes = bytes_read();
+    auto rate = static_cast<double>(bytes - last_bytes);
+    last_bytes = bytes;
+    std::size_t current = active_workers.load();
+
+    // A window that ran out of queued work (between stages, or while the walk feeds the pool) says nothing about how
+    // many workers could have been kept busy, so it neither counts nor gets compared with
+    bool busy = pending.load() >= current;
+    if (!busy or !was_busy) {
+      was_busy = busy;
+      last_rate = 0;
+      continue;
+    }
+    windows_at.at(current)++;
+
+    if (last_rate > 0) {
+      if (rate < last_rate * (1 - margin)) {
+        growing = !growing;
+        step = 1;
+      }
+      else if (rate > last_rate * (1 + margin)) {
+        step = std::min(step * 2, max_step);
+      }
+      else {
+        growing = false;
+        step = 1;
+      }
+    }
+    last_rate = rate;
+
+    std::size_t target = growing ? std::min(current + step, max_workers) : current - std::min(step, current - 1);
+    if (target == current) {
+      // Up against a limit
+      growing = !growing;
+      step = 1;
+      continue;
+    }
+    resize(target);
+  }
+}
+
+// Look a task up by the index stored in `results`.
+auto ThreadPool::task(std::size_t ix) -> Task& {
+  return table[ix];
+}
+
+// Forget every task and result from the last stage. Only call this while the pool is idle.
+auto ThreadPool::reset() -> void {
+  table.clear();
+  segments.clear();
+  chunked.clear();
+  results.clear();
+  finished.store(0, std::memory_order_relaxed);
+}
+
+// The queue is bounded, so this waits for the workers to catch up when it's full. Returns the task's index. Only the
+// enqueueing thread may touch the task through it before join(), and only its `links`, which the workers never read.
+auto ThreadPool::enqueue(Task task) -> std::size_t {
+  Lane& target = lane(task.key.dev);
+  std::size_t ix = table.push(std::move(task));
+  pending.fetch_add(1);
+  if (!chunks(table[ix])) {
+    push(target, ix);
+    return ix;
+  }
+  // Still one pending task, however many segments it's in
+  std::size_t count = (table[ix].size + chunk_segment - 1) / chunk_segment;
+  ChunkedFile& file = chunked.emplace_back(ix, count);
+  for (std::size_t number = 0; number < count; ++number) {
+    push(target, segment_flag | segments.push({&file, number}));
+  }
+  return ix;
+}
+
+auto ThreadPool::push(Lane& target, std::size_t entry) -> void {
+  while (!target.tasks.try_push(entry)) {
+    std::this_thread::yield();
+  }
+  if (sleepers.load() > 0) {
+    std::unique_lock<std::mutex> lock(idle_mutex);
+    condition.notify_one();
+  }
+}
+
+// Hash files at least `threshold` bytes long in segments (0 to never). Set this before start().
+auto ThreadPool::set_chunking(std::size_t threshold) -> void {
+  chunk_threshold = threshold;
+}
+
+// Have workers fill in every task's `location` the first time they open it, for the caller to sort the next stage by.
+// Set this before start().
+auto ThreadPool::set_locating(bool on) -> void {
+  locating = on;
+}
+
+// Whether the current stage hashes a task in segments. Only ever whole files, since a probe or a sample is no more
+// than a few blocks anyway.
+auto ThreadPool::chunks(const Task& task) const -> bool {
+  return chunk_threshold > 0 and task.size >= chunk_threshold and stage_of(task) == Stage::full;
+}
+
+auto ThreadPool::counters() const -> std::vector<const ThreadCounters*> {
+  std::vector<const ThreadCounters*> out;
+  for (const auto& counters : worker_counters) {
+    out.push_back(&counters);
+  }
+  return out;
+}
+
+// Tasks queued or being read right now
+auto ThreadPool::depth() const -> std::size_t {
+  return pending.load(std::memory_order_relaxed);
+}
+
+// Tasks done since the last reset(), including ones that came from the cache
+auto ThreadPool::completed() const -> std::size_t {
+  return finished.load(std::memory_order_relaxed);
+}
+
+// How many bytes the current stage reads of a task
+auto ThreadPool::reads(const Task& task) const -> std::size_t {
+  std::size_t total = 0;
+  for (std::size_t part = 0; part < parts(task); ++part) {
+    total += range(task, part).second;
+  }
+  return total;
+}
+
+auto ThreadPool::busy() -> bool {
+  return pending.load() > 0;
 }
 
 auto ThreadPool::stop() -> void {
   {
-    std::unique_lock<std::mutex> lock(tasks_mutex);
+    std::unique_lock<std::mutex> lock(idle_mutex);
     should_terminate = true;
   }
   condition.notify_all();
+  parked.notify_all();
+  {
+    std::unique_lock<std::mutex> lock(tune_mutex);
+    tune_wake.notify_all();
+  }
+  if (tuner.joinable()) {
+    tuner.join();
+  }
   for (std::thread& active_thread : threads) {
     active_thread.join();
   }
   threads.clear();
 }
 
+// Wait until every queued task has finished, then group the results.
 auto ThreadPool::join() -> void {
-  while (busy()) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  {
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done.wait(lock, [this] { return pending.load() == 0; });
   }
+  results.merge();
 }
@@ -0,0 +1,140 @@
+#include "uring.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+Ring::~Ring() {
+  if (sqes != nullptr) {
+    munmap(sqes, sqes_size);
+  }
+  if (cq_ptr != nullptr and cq_ptr != sq_ptr) {
+    munmap(cq_ptr, cq_size);
+  }
+  if (sq_ptr != nullptr) {
+    munmap(sq_ptr, sq_size);
+  }
+  if (ring_fd >= 0) {
+    close(ring_fd);
+  }
+}
+
+// Set up the ring and map its submission queue, completion queue and SQE array.
+auto Ring::init(unsigned entries) -> bool {
+  io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+
+  ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+  if (ring_fd < 0) {
+    return false;
+  }
+
+  sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+  // Newer kernels let both rings share one mapping
+  bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    sq_size = cq_size = std::max(sq_size, cq_size);
+  }
+
+  sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if (sq_ptr == MAP_FAILED) {
+    sq_ptr = nullptr;
+    return false;
+  }
+
+  if (single_mmap) {
+    cq_ptr = sq_ptr;
+  }
+  else {
+    cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ptr == MAP_FAILED) {
+      cq_ptr = nullptr;
+      return false;
+    }
+  }
+
+  sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  void* sqes_ptr = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (sqes_ptr == MAP_FAILED) {
+    return false;
+  }
+  sqes = static_cast<io_uring_sqe*>(sqes_ptr);
+
+  auto* sq = static_cast<char*>(sq_ptr);
+  sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  sq_entries = params.sq_entries;
+
+  auto* cq = static_cast<char*>(cq_ptr);
+  cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+  cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+
+  return true;
+}
+
+// Queue a single-buffer read. Nothing is handed to the kernel until submit_and_wait().
+auto Ring::prepare_read(int fd, const iovec* iov, std::uint64_t offset, std::uint64_t data) -> bool {
+  unsigned tail = *sq_tail;
+  unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+  if (tail - head >= sq_entries) {
+    return false;
+  }
+
+  unsigned index = tail & sq_mask;
+  io_uring_sqe* sqe = &sqes[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  // READV rather than READ, so that this works all the way back to 5.1
+  sqe->opcode = IORING_OP_READV;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<std::uint64_t>(iov);
+  sqe->len = 1;
+  sqe->off = offset;
+  sqe->user_data = data;
+  sq_array[index] = index;
+
+  __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+  to_submit++;
+  return true;
+}
+
+// Hand everything that has been prepared to the kernel, and wait until at least `wait` reads have completed.
+auto Ring::submit_and_wait(unsigned wait) -> bool {
+  while (true) {
+    long ret = syscall(__NR_io_uring_enter, ring_fd, to_submit, wait, IORING_ENTER_GETEVENTS, nullptr, 0);
+    if (ret >= 0) {
+      to_submit -= static_cast<unsigned>(ret);
+      return true;
+    }
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+}
+
+// Pop one completion, if there is one.
+auto Ring::peek(std::uint64_t& data, std::int32_t& res) -> bool {
+  unsigned head = *cq_head;
+  if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  const io_uring_cqe& cqe = cqes[head & cq_mask];
+  data = cqe.user_data;
+  res = cqe.res;
+  __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+auto Ring::supported() -> bool {
+  Ring ring;
+  return ring.init(1);
+}
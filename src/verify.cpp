@@ -0,0 +1,191 @@
+#include "verify.hpp"
+
+#include "hasher.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+
+static constexpr std::size_t chunk_size = 131072;
+
+// A group can split into as many parts as it has members, and every part keeps one chunk around to compare against.
+// Big groups read smaller chunks, so that all of those together stay around this size.
+static constexpr std::size_t chunk_memory = 16 * 1024 * 1024;
+static constexpr std::size_t min_chunk_size = 4096;
+
+
+Verifier::Verifier(std::size_t threads, std::size_t max_open, const PathTable& paths) : max_open(max_open), paths(paths) {
+  std::size_t upper = std::thread::hardware_concurrency();
+  max_workers = std::max<std::size_t>(std::min(threads, upper), 1);
+  worker_counters = std::vector<ThreadCounters>(max_workers);
+}
+
+auto Verifier::counters() const -> std::vector<const ThreadCounters*> {
+  std::vector<const ThreadCounters*> out;
+  for (const auto& counters : worker_counters) {
+    out.push_back(&counters);
+  }
+  return out;
+}
+
+// Verify every group, spread across the threads. Returns only the groups whose members are truly identical.
+auto Verifier::verify(std::vector<std::vector<Task>> groups) -> std::vector<std::vector<Task>> {
+  std::vector<std::vector<Task>> verified;
+  std::mutex verified_mutex;
+  std::atomic<std::size_t> next = 0;
+
+  auto work = [&](std::size_t worker) {
+    ThreadCounters& counters = worker_counters.at(worker);
+    DirHandles handles(paths);
+    std::vector<std::vector<Task>> local;
+    // The file descriptor budget is split evenly between the threads
+    std::size_t budget = std::max<std::size_t>(max_open / max_workers, 1);
+    for (std::size_t ix = next++; ix < groups.size(); ix = next++) {
+      std::vector<Member> members;
+      members.reserve(groups.at(ix).size());
+      for (auto& task : groups.at(ix)) {
+        members.push_back({std::move(task), -1});
+      }
+      counters.add(Counter::files, members.size());
+      split(std::move(members), local, budget, counters, handles);
+    }
+    std::unique_lock<std::mutex> lock(verified_mutex);
+    std::move(local.begin(), local.end(), std::back_inserter(verified));
+  };
+
+  std::vector<std::thread> threads;
+  for (std::size_t ix = 1; ix < max_workers; ++ix) {
+    threads.emplace_back(work, ix);
+  }
+  work(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return verified;
+}
+
+// Read one chunk of a member. Members keep their file open between chunks while `open` is under `budget`, and
+// otherwise get opened and closed around every read, which is slower but keeps huge groups from running out of fds.
+auto Verifier::read(Member& member, std::size_t offset, std::size_t length, char* out, std::size_t& open, std::size_t budget, ThreadCounters& counters, DirHandles& handles) -> bool {
+  int fd = member.fd;
+  if (fd < 0) {
+    fd = handles.open(member.task.path, O_RDONLY | O_CLOEXEC);
+    counters.add(Counter::opens);
+    if (fd < 0) {
+      return false;
+    }
+    if (open < budget) {
+      member.fd = fd;
+      open++;
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+  }
+
+  std::size_t done = 0;
+  while (done < length) {
+    ssize_t got = pread(fd, out + done, length - done, offset + done);
+    counters.add(Counter::reads);
+    if (got <= 0) {
+      break;
+    }
+    done += got;
+  }
+  counters.add(Counter::bytes, done);
+
+  if (member.fd < 0) {
+    close(fd);
+  }
+  return done == length;
+}
+
+auto Verifier::release(Member& member, std::size_t& open) -> void {
+  if (member.fd >= 0) {
+    close(member.fd);
+    member.fd = -1;
+    open--;
+  }
+}
+
+// Depth first. Only the part that gets worked on next keeps its files open; the ones left waiting on the stack close
+// theirs, and open them again once their turn comes.
+auto Verifier::split(std::vector<Member> members, std::vector<std::vector<Task>>& out, std::size_t budget, ThreadCounters& counters, DirHandles& handles) -> void {
+  std::size_t open = 0;
+
+  std::vector<std::pair<std::vector<Member>, std::size_t>> stack;
+  stack.emplace_back(std::move(members), 0);
+
+  std::vector<char> scratch(chunk_size);
+  Xxh3_64 hasher;
+
+  while (!stack.empty()) {
+    auto [group, offset] = std::move(stack.back());
+    stack.pop_back();
+
+    std::size_t size = group.at(0).task.size;
+    if (offset >= size) {
+      std::vector<Task> identical;
+      for (auto& member : group) {
+        release(member, open);
+        identical.push_back(std::move(member.task));
+      }
+      out.push_back(std::move(identical));
+      continue;
+    }
+
+    std::size_t chunk = std::clamp(chunk_memory / group.size(), min_chunk_size, chunk_size);
+    std::size_t length = std::min(chunk, size - offset);
+
+    // Partition by this chunk's bytes. Members are bucketed by a hash of their chunk, and only compared byte for byte
+    // with the parts in their bucket (almost always just the one). The first member of each part keeps its chunk
+    // around for comparing against.
+    std::vector<std::vector<char>> chunks;
+    std::vector<std::vector<Member>> parts;
+    std::unordered_map<std::uint64_t, std::vector<std::size_t>> buckets;
+
+    for (auto& member : group) {
+      if (!read(member, offset, length, scratch.data(), open, budget, counters, handles)) {
+        release(member, open);
+        continue;
+      }
+      hasher.reset();
+      hasher.update(scratch.data(), length);
+      auto& candidates = buckets[hasher.digest().low64];
+      std::size_t part = parts.size();
+      for (std::size_t candidate : candidates) {
+        if (std::memcmp(chunks.at(candidate).data(), scratch.data(), length) == 0) {
+          part = candidate;
+          break;
+        }
+      }
+      if (part == parts.size()) {
+        chunks.emplace_back(scratch.begin(), scratch.begin() + length);
+        parts.emplace_back();
+        candidates.push_back(part);
+      }
+      parts.at(part).push_back(std::move(member));
+    }
+
+    // Push in reverse, so that the parts come back off the stack in their original order
+    std::size_t base = stack.size();
+    for (std::size_t ix = parts.size(); ix-- > 0;) {
+      if (parts.at(ix).size() < 2) {
+        for (auto& member : parts.at(ix)) {
+          release(member, open);
+        }
+        continue;
+      }
+      stack.emplace_back(std::move(parts.at(ix)), offset + length);
+    }
+    // Every part but the one on top has to wait, so it gives its fds back
+    for (std::size_t ix = base; ix + 1 < stack.size(); ++ix) {
+      for (auto& member : stack.at(ix).first) {
+        release(member, open);
+      }
+    }
+  }
+}
@@ -0,0 +1,388 @@
+#include "walker.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+
+// Big enough that a directory of a few thousand entries comes back in one or two calls
+static constexpr std::size_t dirent_buffer_size = 262144;
+
+// What getdents64() fills the buffer with. glibc only has a wrapper for it from 2.30 on.
+struct linux_dirent64 {
+  std::uint64_t d_ino;
+  std::int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  // NUL-terminated, and really as long as d_reclen says
+  char d_name[1];
+};
+
+
+// A walker with N threads. Threads are only spawned by start().
+Walker::Walker(std::size_t threads, bool recursive, WalkEngine engine) : recursive(recursive), engine(engine), logger(logging::get_logger("xdupes")) {
+  std::size_t upper = std::thread::hardware_concurrency();
+  max_workers = std::max<std::size_t>(std::min(threads, upper), 1);
+  shards = std::vector<Shard>(max_workers);
+}
+
+// Hand out the roots round-robin, then let the threads sort out the rest between themselves.
+auto Walker::start(const std::deque<std::string>& roots) -> void {
+  if (!threads.empty()) {
+    throw std::logic_error("Walker::start() on an active Walker instance");
+  }
+  for (std::size_t ix = 0; ix < roots.size(); ++ix) {
+    push(shards.at(ix % max_workers), paths.add_dir(PathTable::no_parent, roots.at(ix)));
+  }
+  for (std::size_t ix = 0; ix < max_workers; ix++) {
+    threads.emplace_back(&Walker::loop, this, ix);
+  }
+}
+
+auto Walker::loop(std::size_t id) -> void {
+  ThreadCounters& counters = shards.at(id).counters;
+  std::uint32_t dir;
+  bool waiting = false;
+  while (true) {
+    if (pop(id, dir)) {
+      if (waiting) {
+        counters.idle_end();
+        waiting = false;
+      }
+      if (engine == WalkEngine::getdents) {
+        scan_getdents(shards.at(id), dir);
+      }
+      else {
+        scan(shards.at(id), dir);
+      }
+      if (streaming) {
+        Shard& shard = shards.at(id);
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        shard.outbox.insert(shard.outbox.end(), std::make_move_iterator(shard.files.begin()), std::make_move_iterator(shard.files.end()));
+        shard.files.clear();
+      }
+      // Only counted as done after its subdirectories have been pushed, so this can't hit zero early
+      if (outstanding.fetch_sub(1) == 1) {
+        {
+          std::unique_lock<std::mutex> lock(idle_mutex);
+        }
+        idle.notify_all();
+      }
+      continue;
+    }
+    if (outstanding.load() == 0) {
+      break;
+    }
+    if (!waiting) {
+      counters.idle_begin();
+      waiting = true;
+    }
+    sleepers.fetch_add(1);
+    {
+      std::unique_lock<std::mutex> lock(idle_mutex);
+      idle.wait(lock, [this] { return queued.load() > 0 || outstanding.load() == 0; });
+    }
+    sleepers.fetch_sub(1);
+  }
+  if (waiting) {
+    counters.idle_end();
+  }
+}
+
+// Take from the back of our own deque, or steal from the front of someone else's.
+auto Walker::pop(std::size_t id, std::uint32_t& dir) -> bool {
+  for (std::size_t offset = 0; offset < max_workers; ++offset) {
+    Shard& shard = shards.at((id + offset) % max_workers);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    if (shard.dirs.empty()) {
+      continue;
+    }
+    if (offset == 0) {
+      dir = shard.dirs.back();
+      shard.dirs.pop_back();
+    }
+    else {
+      dir = shard.dirs.front();
+      shard.dirs.pop_front();
+    }
+    queued.fetch_sub(1);
+    return true;
+  }
+  return false;
+}
+
+auto Walker::push(Shard& shard, std::uint32_t dir) -> void {
+  outstanding.fetch_add(1);
+  {
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    shard.dirs.push_back(dir);
+    queued.fetch_add(1);
+  }
+  if (sleepers.load() > 0) {
+    std::unique_lock<std::mutex> lock(idle_mutex);
+    idle.notify_one();
+  }
+}
+
+// List one directory. Files go into this thread's own list, so there is nothing to lock.
+auto Walker::scan(Shard& shard, std::uint32_t dir) -> void {
+  namespace fs = std::filesystem;
+
+  fs::path source = paths.dir_path(dir);
+  std::error_code ec;
+
+  // exists(), the permission check, and opening the directory
+  shard.counters.add(Counter::dirs);
+  shard.counters.add(Counter::stats, 2);
+  shard.counters.add(Counter::opens);
+
+  if (!fs::exists(source, ec)) {
+    logger.warn("invalid directory: " + repr(source));
+    return;
+  }
+
+  if (file_is_unreadable(source)) {
+    logger.warn("permission denied: " + repr(source.native()));
+    return;
+  }
+
+  fs::directory_iterator it(source, ec);
+  if (ec) {
+    logger.warn("cannot open directory: " + repr(source.native()) + ": " + ec.message());
+    return;
+  }
+
+  for (; it != fs::directory_iterator(); it.increment(ec)) {
+    if (ec) {
+      logger.warn("error reading directory: " + repr(source.native()) + ": " + ec.message());
+      break;
+    }
+    const fs::directory_entry& entry = *it;
+    if (entry.is_symlink(ec)) {
+      continue;
+    }
+    if (entry.is_directory(ec)) {
+      if (recursive) {
+        push(shard, paths.add_dir(dir, entry.path().filename()));
+      }
+      continue;
+    }
+    if (entry.is_regular_file(ec)) {
+      // One stat gets us the size as well as the identity, which is the same one file_size() would have cost
+      struct stat st;
+      shard.counters.add(Counter::stats);
+      if (lstat(entry.path().c_str(), &st) != 0) {
+        continue;
+      }
+      FileKey key;
+      key.dev = st.st_dev;
+      key.ino = st.st_ino;
+      key.mtime_ns = static_cast<std::uint64_t>(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec;
+      key.ctime_ns = static_cast<std::uint64_t>(st.st_ctim.tv_sec) * 1'000'000'000 + st.st_ctim.tv_nsec;
+      add_file(shard, dir, entry.path().filename().c_str(), st.st_size, key);
+      continue;
+    }
+  }
+}
+
+// Same as scan(), straight on top of the syscalls. The directory is opened once, its entries come back from
+// getdents64() in big batches, and d_type tells directories and symlinks apart without a stat. Regular files get a
+// single statx() relative to the directory's fd, asking for just the fields a FileKey needs, so the kernel never walks
+// the full path again. Only filesystems that don't fill in d_type cost a statx() for every entry.
+auto Walker::scan_getdents(Shard& shard, std::uint32_t dir) -> void {
+  std::string source = paths.dir_path(dir);
+
+  shard.counters.add(Counter::dirs);
+  shard.counters.add(Counter::opens);
+
+  int fd = open(source.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno == ENOENT or errno == ENOTDIR) {
+      logger.warn("invalid directory: " + repr(source));
+    }
+    else if (errno == EACCES) {
+      logger.warn("permission denied: " + repr(source));
+    }
+    else {
+      logger.warn("cannot open directory: " + repr(source) + ": " + std::strerror(errno));
+    }
+    return;
+  }
+
+  if (shard.buffer.empty()) {
+    shard.buffer.resize(dirent_buffer_size);
+  }
+
+  while (true) {
+    long got = syscall(SYS_getdents64, fd, shard.buffer.data(), shard.buffer.size());
+    shard.counters.add(Counter::reads);
+    if (got < 0) {
+      logger.warn("error reading directory: " + repr(source) + ": " + std::strerror(errno));
+      break;
+    }
+    if (got == 0) {
+      break;
+    }
+
+    for (long offset = 0; offset < got;) {
+      const auto* entry = reinterpret_cast<const linux_dirent64*>(shard.buffer.data() + offset);
+      offset += entry->d_reclen;
+
+      const char* name = entry->d_name;
+      if (name[0] == '.' and (name[1] == '\0' or (name[1] == '.' and name[2] == '\0'))) {
+        continue;
+      }
+
+      unsigned char type = entry->d_type;
+      if (type == DT_LNK or (type == DT_DIR and !recursive)) {
+        continue;
+      }
+      if (type == DT_DIR) {
+        push(shard, paths.add_dir(dir, name));
+        continue;
+      }
+      if (type != DT_REG and type != DT_UNKNOWN) {
+        continue;
+      }
+
+      // The type comes along for free, and guards against the entry having been swapped for something else since
+      unsigned int mask = STATX_TYPE | STATX_SIZE | STATX_INO | STATX_MTIME | STATX_CTIME;
+      struct statx stx;
+      shard.counters.add(Counter::stats);
+      if (statx(fd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, mask, &stx) != 0) {
+        continue;
+      }
+      if (S_ISDIR(stx.stx_mode)) {
+        if (recursive) {
+          push(shard, paths.add_dir(dir, name));
+        }
+        continue;
+      }
+      if (!S_ISREG(stx.stx_mode)) {
+        continue;
+      }
+
+      FileKey key;
+      key.dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+      key.ino = stx.stx_ino;
+      key.mtime_ns = static_cast<std::uint64_t>(stx.stx_mtime.tv_sec) * 1'000'000'000 + stx.stx_mtime.tv_nsec;
+      key.ctime_ns = static_cast<std::uint64_t>(stx.stx_ctime.tv_sec) * 1'000'000'000 + stx.stx_ctime.tv_nsec;
+      add_file(shard, dir, name, stx.stx_size, key);
+    }
+  }
+
+  close(fd);
+}
+
+// Only the name gets kept. The directory's part of the path is already in `paths`.
+auto Walker::add_file(Shard& shard, std::uint32_t dir, const char* filename, std::size_t size, const FileKey& key) -> void {
+  std::uint64_t name = paths.add_name(shard.names, filename);
+  shard.files.push_back(Task{PathRef{dir, name}, 0, size, key, {}, 0});
+  shard.counters.add(Counter::files);
+}
+
+auto Walker::busy() -> bool {
+  return outstanding.load(std::memory_order_acquire) > 0;
+}
+
+// Total files found so far, across all threads
+auto Walker::walked() -> std::size_t {
+  std::size_t total = 0;
+  for (const auto& shard : shards) {
+    total += shard.counters.values[static_cast<std::size_t>(Counter::files)].load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+auto Walker::counters() const -> std::vector<const ThreadCounters*> {
+  std::vector<const ThreadCounters*> out;
+  for (const auto& shard : shards) {
+    out.push_back(&shard.counters);
+  }
+  return out;
+}
+
+// Directories waiting to be scanned (or being scanned right now)
+auto Walker::depth() const -> std::size_t {
+  return outstanding.load(std::memory_order_relaxed);
+}
+
+// Hardlinks always share a size, so with `files` sorted by (size, inode) they sit next to each other. Fold every run
+// of paths to the same inode into the first one (alphabetically), so each inode only gets read once. Full paths are
+// only built for those runs, which are rare.
+auto Walker::collapse() -> void {
+  std::sort(files.begin(), files.end(), [](const Task& left, const Task& right) {
+    return std::tie(left.size, left.key.dev, left.key.ino) < std::tie(right.size, right.key.dev, right.key.ino);
+  });
+  std::size_t out = 0;
+  for (std::size_t begin = 0, end = 0; begin < files.size(); begin = end) {
+    end = begin + 1;
+    while (end < files.size() and files.at(end).key.dev == files.at(begin).key.dev and files.at(end).key.ino == files.at(begin).key.ino) {
+      end++;
+    }
+    if (end - begin > 1) {
+      std::vector<std::pair<std::string, PathRef>> names;
+      for (std::size_t ix = begin; ix < end; ++ix) {
+        names.emplace_back(paths.path(files.at(ix).path), files.at(ix).path);
+      }
+      std::sort(names.begin(), names.end(), [](const auto& left, const auto& right) { return left.first < right.first; });
+      files.at(begin).path = names.at(0).second;
+      for (std::size_t ix = 1; ix < names.size(); ++ix) {
+        files.at(begin).links.push_back(names.at(ix).second);
+      }
+      collapsed += end - begin - 1;
+    }
+    if (out != begin) {
+      files.at(out) = std::move(files.at(begin));
+    }
+    out++;
+  }
+  files.resize(out);
+}
+
+// Move every file found since the last call into `out`. Returns whether there were any.
+auto Walker::take(std::vector<Task>& out) -> bool {
+  std::size_t before = out.size();
+  for (auto& shard : shards) {
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    out.insert(out.end(), std::make_move_iterator(shard.outbox.begin()), std::make_move_iterator(shard.outbox.end()));
+    shard.outbox.clear();
+  }
+  return out.size() > before;
+}
+
+// Hand files over through take() as the walk goes, instead of all at once from join(). Set this before start().
+auto Walker::set_streaming(bool enabled) -> void {
+  streaming = enabled;
+}
+
+// Wait for the walk to finish, then merge every thread's files.
+auto Walker::join() -> void {
+  for (std::thread& active_thread : threads) {
+    active_thread.join();
+  }
+  threads.clear();
+
+  if (streaming) {
+    return;
+  }
+
+  std::size_t total_files = 0;
+  for (const auto& shard : shards) {
+    total_files += shard.files.size();
+  }
+  files.reserve(files.size() + total_files);
+
+  for (auto& shard : shards) {
+    files.insert(files.end(), std::make_move_iterator(shard.files.begin()), std::make_move_iterator(shard.files.end()));
+    shard.files = {};
+  }
+
+  collapse();
+}
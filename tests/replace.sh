@@ -0,0 +1,80 @@
+#!/bin/sh
+# --replace on a generated tree: every group has to end up as one inode (or as symlinks to the one file that was kept),
+# with no temporary links left over, and the same bytes behind every path as before.
+# Usage: replace.sh XDUPES
+set -u
+
+xdupes=$1
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+fail() {
+  echo "$*"
+  exit 1
+}
+
+# Groups of 2 to 5 copies spread over a few directories, some of them with a hardlink already, and files with no copy
+generate() {
+  tree=$1
+  for d in 1 2 3 4; do
+    mkdir -p "$tree/d$d/sub"
+  done
+  for g in 1 2 3 4 5 6 7 8; do
+    copies=$((g % 4 + 2))
+    i=1
+    while [ "$i" -le "$copies" ]; do
+      cp "$work/ref/g$g" "$tree/d$(((g + i) % 4 + 1))/g$g-$i"
+      i=$((i + 1))
+    done
+    if [ $((g % 2)) -eq 0 ]; then
+      ln "$tree/d$(((g + 1) % 4 + 1))/g$g-1" "$tree/d$(((g + 2) % 4 + 1))/sub/g$g-alias"
+    fi
+    cp "$work/ref/u$g" "$tree/d$((g % 4 + 1))/sub/u$g"
+  done
+}
+
+mkdir "$work/ref"
+for g in 1 2 3 4 5 6 7 8; do
+  head -c $((g * 3000 + 1)) /dev/urandom > "$work/ref/g$g"
+  head -c $((g * 3000 + 1)) /dev/urandom > "$work/ref/u$g"
+done
+
+for mode in hardlink symlink; do
+  tree="$work/$mode"
+  generate "$tree"
+  inodes_before=$(for g in 1 2 3 4 5 6 7 8; do stat -c %i "$(find "$tree" -name "u$g")"; done)
+
+  "$xdupes" -r "$tree" --replace "$mode" --threads 4 > /dev/null 2>&1 || fail "--replace $mode failed"
+
+  leftovers=$(find "$tree" -name '.xdupes-*')
+  [ -z "$leftovers" ] || fail "--replace $mode left temporary links behind: $leftovers"
+
+  for g in 1 2 3 4 5 6 7 8; do
+    paths=$(find "$tree" -name "g$g-*")
+    [ -n "$paths" ] || fail "--replace $mode lost every path of group $g"
+    kept=""
+    for path in $paths; do
+      cmp -s "$path" "$work/ref/g$g" || fail "--replace $mode changed the contents behind $path"
+      if [ -L "$path" ]; then
+        [ "$mode" = symlink ] || fail "--replace $mode made a symlink: $path"
+        continue
+      fi
+      inode=$(stat -c %i "$path")
+      if [ "$mode" = symlink ] && [ -n "$kept" ] && [ "$inode" != "$kept" ]; then
+        fail "--replace symlink left more than one file in group $g"
+      fi
+      kept=${kept:-$inode}
+      [ "$inode" = "$kept" ] || fail "--replace $mode left more than one inode in group $g"
+    done
+    [ -n "$kept" ] || fail "--replace $mode kept no file in group $g"
+    # Symlinks have to lead to the file that was kept, not just to the same bytes
+    for path in $paths; do
+      if [ -L "$path" ]; then
+        [ "$(stat -L -c %i "$path")" = "$kept" ] || fail "$path doesn't point at the kept file of group $g"
+      fi
+    done
+  done
+
+  inodes_after=$(for g in 1 2 3 4 5 6 7 8; do stat -c %i "$(find "$tree" -name "u$g")"; done)
+  [ "$inodes_before" = "$inodes_after" ] || fail "--replace $mode touched files that have no duplicate"
+done
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Two files of the same size that can't be read must not come out as duplicates of each other.
+# Usage: unreadable.sh XDUPES
+set -u
+
+xdupes=$1
+dir=$(mktemp -d)
+trap 'chmod -R u+rw "$dir"; rm -rf "$dir"' EXIT
+
+head -c 10000 /dev/urandom > "$dir/a"
+head -c 10000 /dev/urandom > "$dir/b"
+chmod 000 "$dir/a" "$dir/b"
+chmod 755 "$dir"
+
+# Root reads through chmod 000, so drop to nobody where we can, and skip otherwise
+run=""
+if [ "$(id -u)" -eq 0 ]; then
+  if ! command -v setpriv > /dev/null; then
+    echo "skipped: running as root without setpriv"
+    exit 77
+  fi
+  run="setpriv --reuid nobody --regid nogroup --clear-groups"
+fi
+
+for engine in sync uring; do
+  out=$($run "$xdupes" -r "$dir" --io-engine "$engine" 2> /dev/null)
+  if [ -n "$out" ]; then
+    echo "unreadable files were grouped with --io-engine $engine:"
+    echo "$out"
+    exit 1
+  fi
+done